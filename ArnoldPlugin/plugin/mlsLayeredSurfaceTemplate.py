@@ -16,6 +16,20 @@ class AEmlsLayeredSurfaceTemplate(ShaderAETemplate):
         self.addControl('param', label='Param')
         self.endLayout()
 
+        self.beginLayout('Flattened Layers', collapse=True)
+        self.addControl('layerAlbedo', label='Albedo')
+        self.addControl('layerEta', label='IOR')
+        self.addControl('layerKappa', label='Kappa')
+        self.addControl('layerRoughness', label='Roughness')
+        self.addControl('layerDepth', label='Depth')
+        self.addControl('layerG', label='g')
+        self.endLayout()
+
+        self.beginLayout('Optimization', collapse=True)
+        self.addControl('angularTable', label='Angular Table')
+        self.addControl('angularTableTolerance', label='Table Tolerance')
+        self.endLayout()
+
         # self.beginLayout('Layer M', collapse=False)
         # self.addControl('albedo_m', label='Volumetric Color')
         # self.addControl('depth_m', label='Volumetric Depth')
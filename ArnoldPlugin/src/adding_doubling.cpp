@@ -1,125 +1,25 @@
 #include "util.h"
-#include "ppmimage.h"
-#include <fstream>
-
-struct TIR {
-    TIR(const std::string& path) {
-        std::ifstream in(path);
-        // Warn if not loaded
-        if (in.bad() || in.fail()) {
-            return;
-        }
-        ok = true;
-        this->load(in);
-    }
-
-    void load(std::ifstream& in) {
-        // Read sizes
-        in.read((char*)&Nt, sizeof(int));
-        in.read((char*)&Na, sizeof(int));
-        in.read((char*)&Nn, sizeof(int));
-        //SLog(EInfo, "Loading TIR texture of dimension %dx%dx%dx", Nt, Na, Nn);
-        sizes[0] = Nt;
-        sizes[1] = Na;
-        sizes[2] = Nn;
-
-        // Read data range (min / max)
-        float mM[6];
-        in.read((char*)mM, 6 * sizeof(float));
-        tm = mM[0]; tM = mM[1];
-        am = mM[2]; aM = mM[3];
-        nm = mM[4]; nM = mM[5];
-        //SLog(EInfo, "Range [%f, %f; %f, %f; %f, %f]", tm, tM, am, aM, nm, nM);
-
-        // Read data
-        const int size = Nt * Na * Nn;
-        buff.assign(size, 0.0f);
-        in.read((char*)buff.data(), size * sizeof(float));
-    }
-
-    inline float operator() (float t, float a, float n) const {
-
-        // Floating point index
-        float ta = Nt * (t - tm) / (tM - tm);
-        float aa = Na * (a - am) / (aM - am);
-        float na = Nn * (n - nm) / (nM - nm);
-
-        // Integer index
-        int ti = floor(ta);
-        int ai = floor(aa);
-        int ni = floor(na);
-
-        // Ensure the indexes stays in the limits
-        ti = _clamp<int>(ti, 0, Nt - 1);
-        ai = _clamp<int>(ai, 0, Na - 1);
-        ni = _clamp<int>(ni, 0, Nn - 1);
-
-        //*
-        // Clamp the interpolation weights
-        float alphas[3] = { ta - ti, aa - ai, na - ni };
-        for (int i = 0; i < 3; ++i) {
-            alphas[i] = _clamp<float>(alphas[i], 0.0f, 1.0f);
-        }
-
-        // Index of the middle point
-        const int indices[3] = { ti, ai, ni };
-        const int index = ni + Nn * (ai + Na * ti);
-
-        // Result vector and norm
-        float v = 0.0f;
-        float V = 0.0f;
-
-        // For every possible combinaison of index shift per dimension,
-        // fetch the value in memory and do linear interpolation.
-        // We fetch using shift of 0 and 1.
-        //
-        //     v(i+di, j+di, k+dk, l+dl),  where dk in [0,1]
-        //
-        const unsigned int D = pow(2, 3);
-        for (unsigned int d = 0; d < D; ++d) {
-
-            float alpha = 1.0; // Global alpha
-            int   cid_s = 0;   // Id shift
-
-            // Evaluate the weight of the sample d which correspond to
-            // one for the shifted configuration:
-            // The weight is the product of the weights per dimension.
-            //
-            for (int i = 0; i < 3; ++i) {
-                bool  bitset = ((1 << i) & d);
-                float calpha = (bitset) ? alphas[i] : 1.0 - alphas[i];
-
-                // Correct the shift to none if we go out of the grid
-                if (indices[i] + 1 >= sizes[i]) {
-                    bitset = false;
-                }
-
-                alpha *= calpha;
-                cid_s = cid_s * sizes[i] + ((bitset) ? 1 : 0);
-            }
-
-            const float tmp = buff[index + cid_s];
-            if (!std::isnan(tmp)) {
-                v += alpha * tmp;
-                V += alpha;
-            }
-        }
-
-        return v;
-    }
-
-private:
-    std::vector<float> buff;
-    int sizes[3];
-    int Nt, Na, Nn;
-    float tm, tM, aM, am, nm, nM;
-public:
-    bool ok = false;
-};
-
-TIR m_TIR("TIR.bin");
-//BMPImage Ess((getDllDirectory() / "Ess.bmp").string());
-PPMImage Ess("E:/CIS6600_/SIG_TOOL/plugin/Ess.ppm");
+#include "mls_bsdf.h"
+#include "simd_rgb.h"
+#include "tir_table.h"
+#include "ess_table.h"
+#include "fresnel.h"
+
+// Bilinear lookup in the embedded Ess table
+static float evalEss(float ct, float alpha) {
+    const float x = _clamp<float>(ct, 0.0f, 1.0f) * (ESS_RES_COS - 1);
+    const float y = _clamp<float>(alpha, 0.0f, 1.0f) * (ESS_RES_ALPHA - 1);
+    const int x0 = std::min((int)x, ESS_RES_COS - 2);
+    const int y0 = std::min((int)y, ESS_RES_ALPHA - 2);
+    const float wx = x - x0;
+    const float wy = y - y0;
+
+    const float* row0 = ESS_TABLE + y0 * ESS_RES_COS + x0;
+    const float* row1 = row0 + ESS_RES_COS;
+    const float e0 = row0[0] + wx * (row0[1] - row0[0]);
+    const float e1 = row1[0] + wx * (row1[1] - row1[0]);
+    return e0 + wy * (e1 - e0);
+}
 
 float fresnelDielectric(float cosTi, float eta) {
     cosTi = AiClamp(cosTi, -1.f, 1.f);
@@ -175,33 +75,39 @@ float fresnelConductor(float CosTheta, float Eta, float Etak)
     return 0.5 * (Rp + Rs);
 }
 
-void evalFresnel(float ct, const AtRGB& albedo, float alpha, float eta, float kappa,
-    AtRGB& Rij, AtRGB& Tij) {
+template<typename RGB>
+void evalFresnel(float ct, const RGB& albedo, float alpha, float eta, float kappa,
+    RGB& Rij, RGB& Tij) {
     float fresnel = (kappa == 0.0f) ? fresnelDielectric(ct, eta) :
         fresnelConductor(ct, eta, kappa);
-    Rij = (kappa == 0.0f) ? fresnel * AtRGB(1.0f) :
-        albedo * fresnel / (sqr(1 - eta) + sqr(kappa)) * (sqr(1 + eta) + sqr(kappa));
-    float ess = (Ess.getPixel(abs(ct), alpha).r)/255.f;
+    Rij = (kappa == 0.0f) ? RGB(fresnel) :
+        albedo * (fresnel / (sqr(1 - eta) + sqr(kappa)) * (sqr(1 + eta) + sqr(kappa)));
+    float ess = evalEss(fabsf(ct), alpha);
     Rij *= (1 + fresnel * (1 - ess) / ess);
-    Tij = (kappa == 0.0f) ? (AtRGB(1.0) - Rij): AtRGB(0.0);
+    Tij = (kappa == 0.0f) ? (RGB(1.0f) - Rij): RGB(0.0f);
 }
 
-void computeAddingDoubling(
+// Adding-doubling recursion, instantiated for AtRGB (scalar reference) and for
+// RGB4, which packs the RGB energy terms in one SSE register.
+template<typename RGB>
+static void addingDoubling(
     float cosNI, const int nb_layers,
-    const std::vector<AtRGB>& m_albedos,
-    const std::vector<float>& m_etas,
-    const std::vector<float>& m_kappas,
-    const std::vector<float>& m_alphas,
-    const std::vector<float>& m_depths,
-    const std::vector<AtRGB>& m_sigma_a,
-    const std::vector<AtRGB>& m_sigma_s,
+    const AtRGB* m_albedos,
+    const float* m_etas,
+    const float* m_kappas,
+    const float* m_alphas,
+    const float* m_depths,
+    const AtRGB* m_sigma_a,
+    const AtRGB* m_sigma_s,
     AtRGB* coeffs,
     float* alphas, 
     int &nb_valid) {
 
+    const TIRTable& m_TIR = TIRTable::get();
+
     // Variables
     float cti = cosNI;
-    AtRGB R0i(0.0f), Ri0(0.0f), T0i(1.0f), Ti0(1.0f);
+    RGB R0i(0.0f), Ri0(0.0f), T0i(1.0f), Ti0(1.0f);
     float s_r0i = 0.0f, s_ri0 = 0.0f, s_t0i = 0.0f, s_ti0 = 0.0f;
     float j0i = 1.0f, ji0 = 1.0f;
 
@@ -219,20 +125,21 @@ void computeAddingDoubling(
         float depth = m_depths[i];
         //float depth = 0.0f;
 
-        AtRGB R12, T12, R21, T21;
+        RGB R12, T12, R21, T21;
         float s_r12 = 0.0f, s_r21 = 0.0f, s_t12 = 0.0f, s_t21 = 0.0f, j12 = 1.0f, j21 = 1.0f, ctt;
         if (depth > 0.0f) {
             /* Mean doesn't change with volumes */
             ctt = cti;
 
             /* Evaluate transmittance */
-            const AtRGB sigma_t = m_sigma_a[i] + m_sigma_s[i];
-            T12 = (AtRGB(1.0f) + m_sigma_s[i] * depth / ctt) * AiRGBExp(-(depth / ctt) * sigma_t);
+            const RGB sigma_s(m_sigma_s[i]);
+            const RGB sigma_t = RGB(m_sigma_a[i]) + sigma_s;
+            T12 = (RGB(1.0f) + sigma_s * (depth / ctt)) * rgbExp(-(depth / ctt) * sigma_t);
             //T12 = (AtRGB(1.0f) + AtRGB(100.0F) * 0.001f / ctt) * AiRGBExp(-(0.001F / ctt) * AtRGB(100.F));
             //T12 = AtRGB(1.0f);
             T21 = T12;
-            R12 = AtRGB(0.0f);
-            R21 = AtRGB(0.0f);
+            R12 = RGB(0.0f);
+            R21 = RGB(0.0f);
 
             /* Fetch precomputed variance for HG phase function */
             s_t12 = alpha * depth * 0.25;
@@ -275,40 +182,41 @@ void computeAddingDoubling(
             auto temp_alpha = varianceToRoughness(s_t0i + s_r12);
 
             /* Evaluate r12, r21, t12, t21 */
-            evalFresnel(cti, m_albedos[i], temp_alpha, eta, kappa, R12, T12);
+            evalFresnel(cti, RGB(m_albedos[i]), temp_alpha, eta, kappa, R12, T12);
             if (has_transmissive) {
                 R21 = R12;
                 T21 = T12 /* (n12*n12) */; // We don't need the IOR scaling since we are
             }
             else {
-                R21 = AtRGB(0.0f);
-                T21 = AtRGB(0.0f);
-                T12 = AtRGB(0.0f);
+                R21 = RGB(0.0f);
+                T21 = RGB(0.0f);
+                T12 = RGB(0.0f);
             }
 
             /* Evaluate TIR using the decoupling approximation */
-            if (i > 0 && m_TIR.ok) {
+            if (i > 0 && m_TIR.ok()) {
                 float eta_0 = m_etas[i - 1];
                 float n10 = (eta_0 / eta_1);
 
                 const float _TIR = m_TIR(cti, temp_alpha, n10);
                 Ri0 += (1.0f - _TIR) * Ti0;
-                Ri0 = AiRGBClamp(Ri0, 0.0, 1.0);
+                Ri0 = rgbClamp(Ri0, 0.0f, 1.0f);
                 Ti0 *= _TIR;
             }
         }
 
         /* Multiple scattering forms */
-        const AtRGB denom = (AtRGB(1.0f) - Ri0 * R12);
-        const AtRGB m_R0i = (average(denom) <= 0.0f) ? AtRGB(0.0f) : (T0i * R12 * Ti0) / denom;
-        const AtRGB m_Ri0 = (average(denom) <= 0.0f) ? AtRGB(0.0f) : (T21 * Ri0 * T12) / denom;
-        const AtRGB m_Rr = (average(denom) <= 0.0f) ? AtRGB(0.0f) : (Ri0 * R12) / denom;
+        const RGB denom = (RGB(1.0f) - Ri0 * R12);
+        const bool blocked = average(denom) <= 0.0f;
+        const RGB m_R0i = blocked ? RGB(0.0f) : (T0i * R12 * Ti0) / denom;
+        const RGB m_Ri0 = blocked ? RGB(0.0f) : (T21 * Ri0 * T12) / denom;
+        const RGB m_Rr = blocked ? RGB(0.0f) : (Ri0 * R12) / denom;
 
         /* Evaluate the adding operator on the energy */
-        const AtRGB e_R0i = R0i + m_R0i;
-        const AtRGB e_T0i = (T0i * T12) / denom;
-        const AtRGB e_Ri0 = R21 + m_Ri0;
-        const AtRGB e_Ti0 = (T21 * Ti0) / denom;
+        const RGB e_R0i = R0i + m_R0i;
+        const RGB e_T0i = (T0i * T12) / denom;
+        const RGB e_Ri0 = R21 + m_Ri0;
+        const RGB e_Ti0 = (T21 * Ti0) / denom;
 
         /* Scalar forms for the spectral quantities */
         const float r0i = average(R0i);
@@ -329,7 +237,7 @@ void computeAddingDoubling(
 
         /* Store the coefficient and variance */
         if (m_r0i > 0.0f) {
-            coeffs[i] = m_R0i;
+            coeffs[i] = toAtRGB(m_R0i);
             alphas[i] = varianceToRoughness(s_ti0 + j0i * (s_t0i + s_r12 + m_rr * (s_r12 + s_ri0)));
         }
         else {
@@ -364,4 +272,48 @@ void computeAddingDoubling(
     }
 
     nb_valid = nb_layers;
-}
\ No newline at end of file
+}
+
+void computeAddingDoubling(
+    float cosNI, const int nb_layers,
+    const AtRGB* m_albedos,
+    const float* m_etas,
+    const float* m_kappas,
+    const float* m_alphas,
+    const float* m_depths,
+    const AtRGB* m_sigma_a,
+    const AtRGB* m_sigma_s,
+    AtRGB* coeffs,
+    float* alphas,
+    int& nb_valid) {
+    addingDoubling<RGB4>(cosNI, nb_layers, m_albedos, m_etas, m_kappas, m_alphas, m_depths, m_sigma_a, m_sigma_s,
+        coeffs, alphas, nb_valid);
+}
+
+void computeAddingDoublingScalar(
+    float cosNI, const int nb_layers,
+    const AtRGB* m_albedos,
+    const float* m_etas,
+    const float* m_kappas,
+    const float* m_alphas,
+    const float* m_depths,
+    const AtRGB* m_sigma_a,
+    const AtRGB* m_sigma_s,
+    AtRGB* coeffs,
+    float* alphas,
+    int& nb_valid) {
+    addingDoubling<AtRGB>(cosNI, nb_layers, m_albedos, m_etas, m_kappas, m_alphas, m_depths, m_sigma_a, m_sigma_s,
+        coeffs, alphas, nb_valid);
+}
+uint64_t addingDoublingDataHash() {
+    static const uint64_t hash = [] {
+        const uint32_t max_layers = MLS_MAX_LAYERS;
+        const uint64_t tir_hash = TIRTable::get().contentHash();
+
+        uint64_t h = fnv1a64(MLS_PLUGIN_VERSION, sizeof(MLS_PLUGIN_VERSION));
+        h = fnv1a64(&max_layers, sizeof(max_layers), h);
+        h = fnv1a64(&tir_hash, sizeof(tir_hash), h);
+        return fnv1a64(ESS_TABLE, sizeof(ESS_TABLE), h);
+    }();
+    return hash;
+}
@@ -0,0 +1,100 @@
+#include "angular_table.h"
+
+// Grazing angles are clamped since the recursion divides by cosNO
+static const float MIN_COS = 1e-4f;
+
+static float gridCos(int k, int resolution) {
+    return std::max(k / float(resolution - 1), MIN_COS);
+}
+
+static void evalDirect(const LayerStackBSDF& stack, float cosNO, AtRGB* coeffs, float* alphas, int& nb_valid) {
+    computeAddingDoubling(cosNO, stack.nb_layers, stack.albedos, stack.etas, stack.kappas, stack.alphas, stack.depths, stack.sigma_a, stack.sigma_s,
+        coeffs, alphas, nb_valid);
+}
+
+static float maxError(const AtRGB* coeffs_a, const float* alphas_a, const AtRGB* coeffs_b, const float* alphas_b, int nb_valid) {
+    float err = 0.0f;
+    for (int i = 0; i < nb_valid; ++i) {
+        err = std::max(err, fabsf(coeffs_a[i].r - coeffs_b[i].r));
+        err = std::max(err, fabsf(coeffs_a[i].g - coeffs_b[i].g));
+        err = std::max(err, fabsf(coeffs_a[i].b - coeffs_b[i].b));
+        err = std::max(err, fabsf(alphas_a[i] - alphas_b[i]));
+    }
+    return err;
+}
+
+bool AngularTable::build(const LayerStackBSDF& stack, float tolerance, float& mean_error, float& max_error) {
+    AtRGB direct_coeffs[MLS_MAX_LAYERS];
+    float direct_alphas[MLS_MAX_LAYERS];
+    AtRGB table_coeffs[MLS_MAX_LAYERS];
+    float table_alphas[MLS_MAX_LAYERS];
+
+    reset();
+    for (int res = MIN_RESOLUTION; res <= MAX_RESOLUTION; res *= 2) {
+        resolution = res;
+        coeffs.assign(res * MLS_MAX_LAYERS, AtRGB(0.0f));
+        alphas.assign(res * MLS_MAX_LAYERS, 0.0f);
+        coeff_data = coeffs.data();
+        alpha_data = alphas.data();
+
+        for (int k = 0; k < res; ++k) {
+            evalDirect(stack, gridCos(k, res), &coeffs[k * MLS_MAX_LAYERS], &alphas[k * MLS_MAX_LAYERS], nb_valid);
+        }
+
+        /* Accuracy check against the direct path, midway between grid points */
+        mean_error = 0.0f;
+        max_error = 0.0f;
+        for (int k = 0; k + 1 < res; ++k) {
+            const float ct = 0.5f * (gridCos(k, res) + gridCos(k + 1, res));
+            int direct_valid = 0, table_valid = 0;
+            evalDirect(stack, ct, direct_coeffs, direct_alphas, direct_valid);
+            lookup(ct, table_coeffs, table_alphas, table_valid);
+            const float err = maxError(direct_coeffs, direct_alphas, table_coeffs, table_alphas, direct_valid);
+            mean_error += err;
+            max_error = std::max(max_error, err);
+        }
+        mean_error /= (res - 1);
+
+        if (mean_error <= tolerance) {
+            return true;
+        }
+    }
+
+    reset();
+    return false;
+}
+
+void AngularTable::attach(std::unique_ptr<MappedFile> file, const AtRGB* mapped_coeffs, const float* mapped_alphas, int res, int valid) {
+    reset();
+    mapping = std::move(file);
+    coeff_data = mapped_coeffs;
+    alpha_data = mapped_alphas;
+    resolution = res;
+    nb_valid = valid;
+}
+
+void AngularTable::reset() {
+    resolution = 0;
+    nb_valid = 0;
+    coeffs.clear();
+    alphas.clear();
+    coeff_data = nullptr;
+    alpha_data = nullptr;
+    mapping.reset();
+}
+
+void AngularTable::lookup(float cosNO, AtRGB* out_coeffs, float* out_alphas, int& out_nb_valid) const {
+    const float x = _clamp<float>(cosNO, 0.0f, 1.0f) * (resolution - 1);
+    const int k = std::min(int(x), resolution - 2);
+    const float w = x - k;
+
+    const AtRGB* c0 = coeff_data + k * MLS_MAX_LAYERS;
+    const AtRGB* c1 = c0 + MLS_MAX_LAYERS;
+    const float* a0 = alpha_data + k * MLS_MAX_LAYERS;
+    const float* a1 = a0 + MLS_MAX_LAYERS;
+    for (int i = 0; i < nb_valid; ++i) {
+        out_coeffs[i] = c0[i] + (c1[i] - c0[i]) * w;
+        out_alphas[i] = a0[i] + (a1[i] - a0[i]) * w;
+    }
+    out_nb_valid = nb_valid;
+}
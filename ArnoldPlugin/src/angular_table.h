@@ -0,0 +1,40 @@
+#pragma once
+#include "mls_bsdf.h"
+#include "file_utils.h"
+#include <memory>
+
+// Adding-doubling output (per-interface coeffs and roughnesses) tabulated over
+// cosNO for a stack with constant parameters. Built once when the node updates
+// and linearly interpolated at shade time instead of running the recursion.
+struct AngularTable
+{
+    static const int MIN_RESOLUTION = 32;
+    static const int MAX_RESOLUTION = 2048;
+
+    std::vector<AtRGB> coeffs;  // resolution * MLS_MAX_LAYERS
+    std::vector<float> alphas;  // resolution * MLS_MAX_LAYERS
+    int resolution = 0;
+    int nb_valid = 0;
+
+    // What lookup reads: the vectors above, or a mapped cache file
+    const AtRGB* coeff_data = nullptr;
+    const float* alpha_data = nullptr;
+    std::unique_ptr<MappedFile> mapping;
+
+    // Tabulates the stack, doubling the resolution until the mean absolute error
+    // against the direct path, checked halfway between grid points, is below
+    // tolerance. The mean is used since the direct path has discontinuities
+    // (e.g. the total internal reflection cut-off) that no grid resolves in the
+    // max norm.
+    // Returns false (and leaves the table empty) if MAX_RESOLUTION isn't enough.
+    bool build(const LayerStackBSDF& stack, float tolerance, float& mean_error, float& max_error);
+
+    // Uses tables stored in a mapped file (see stack_cache.h) instead of the vectors
+    void attach(std::unique_ptr<MappedFile> file, const AtRGB* mapped_coeffs, const float* mapped_alphas, int res, int valid);
+
+    void reset();
+
+    void lookup(float cosNO, AtRGB* out_coeffs, float* out_alphas, int& out_nb_valid) const;
+
+    bool empty() const { return resolution == 0; }
+};
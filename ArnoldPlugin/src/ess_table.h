@@ -0,0 +1,45 @@
+#pragma once
+
+// Directional albedo Ess(cos theta, alpha) of the GGX lobe, used by evalFresnel
+// for multiple-scattering energy compensation. Rows are roughness and columns
+// are cos theta, both sampled uniformly over [0, 1] (endpoints included).
+// Converted from the 8-bit plugin/Ess.ppm the plugin used to load at startup,
+// kept as the reference for these values. mls_lut_generator --ess estimates
+// the table anew, which changes the look of existing materials.
+static const int ESS_RES_COS = 32;
+static const int ESS_RES_ALPHA = 32;
+
+static const float ESS_TABLE[ESS_RES_ALPHA * ESS_RES_COS] = {
+    0.929412f, 0.980392f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f,
+    1.000000f, 0.968627f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f,
+    0.960784f, 0.941176f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f,
+    0.952941f, 0.905882f, 0.980392f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f,
+    0.952941f, 0.882353f, 0.941176f, 0.972549f, 0.984314f, 0.992157f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f,
+    0.960784f, 0.874510f, 0.901961f, 0.945098f, 0.964706f, 0.976471f, 0.984314f, 0.988235f, 0.992157f, 0.992157f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f, 1.000000f,
+    0.964706f, 0.878431f, 0.878431f, 0.917647f, 0.941176f, 0.960784f, 0.968627f, 0.976471f, 0.984314f, 0.988235f, 0.988235f, 0.992157f, 0.992157f, 0.992157f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 1.000000f, 1.000000f,
+    0.964706f, 0.882353f, 0.874510f, 0.894118f, 0.917647f, 0.937255f, 0.952941f, 0.960784f, 0.968627f, 0.976471f, 0.980392f, 0.984314f, 0.984314f, 0.988235f, 0.988235f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f, 0.996078f,
+    0.968627f, 0.890196f, 0.874510f, 0.878431f, 0.894118f, 0.913725f, 0.929412f, 0.945098f, 0.952941f, 0.960784f, 0.968627f, 0.972549f, 0.972549f, 0.980392f, 0.980392f, 0.984314f, 0.984314f, 0.988235f, 0.988235f, 0.988235f, 0.988235f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.992157f, 0.996078f,
+    0.968627f, 0.894118f, 0.878431f, 0.874510f, 0.882353f, 0.894118f, 0.905882f, 0.921569f, 0.933333f, 0.941176f, 0.949020f, 0.956863f, 0.960784f, 0.968627f, 0.972549f, 0.976471f, 0.976471f, 0.980392f, 0.984314f, 0.984314f, 0.984314f, 0.984314f, 0.984314f, 0.988235f, 0.988235f, 0.988235f, 0.988235f, 0.988235f, 0.988235f, 0.988235f, 0.992157f, 0.992157f,
+    0.960784f, 0.898039f, 0.882353f, 0.870588f, 0.870588f, 0.882353f, 0.890196f, 0.901961f, 0.909804f, 0.921569f, 0.929412f, 0.941176f, 0.945098f, 0.952941f, 0.956863f, 0.960784f, 0.964706f, 0.968627f, 0.972549f, 0.972549f, 0.976471f, 0.976471f, 0.976471f, 0.980392f, 0.980392f, 0.980392f, 0.984314f, 0.984314f, 0.984314f, 0.984314f, 0.988235f, 0.984314f,
+    0.960784f, 0.898039f, 0.882353f, 0.870588f, 0.862745f, 0.870588f, 0.874510f, 0.882353f, 0.894118f, 0.901961f, 0.909804f, 0.921569f, 0.925490f, 0.937255f, 0.941176f, 0.945098f, 0.952941f, 0.956863f, 0.960784f, 0.956863f, 0.960784f, 0.964706f, 0.968627f, 0.972549f, 0.972549f, 0.972549f, 0.972549f, 0.976471f, 0.976471f, 0.976471f, 0.976471f, 0.980392f,
+    0.949020f, 0.898039f, 0.882353f, 0.870588f, 0.862745f, 0.862745f, 0.862745f, 0.870588f, 0.878431f, 0.886275f, 0.890196f, 0.898039f, 0.905882f, 0.913725f, 0.917647f, 0.925490f, 0.933333f, 0.937255f, 0.941176f, 0.945098f, 0.945098f, 0.949020f, 0.956863f, 0.956863f, 0.960784f, 0.960784f, 0.964706f, 0.964706f, 0.964706f, 0.968627f, 0.968627f, 0.968627f,
+    0.941176f, 0.894118f, 0.882353f, 0.870588f, 0.858824f, 0.854902f, 0.854902f, 0.854902f, 0.858824f, 0.866667f, 0.870588f, 0.878431f, 0.886275f, 0.894118f, 0.898039f, 0.905882f, 0.913725f, 0.913725f, 0.921569f, 0.929412f, 0.929412f, 0.937255f, 0.937255f, 0.937255f, 0.945098f, 0.949020f, 0.949020f, 0.952941f, 0.952941f, 0.956863f, 0.956863f, 0.956863f,
+    0.933333f, 0.894118f, 0.878431f, 0.866667f, 0.854902f, 0.847059f, 0.847059f, 0.847059f, 0.847059f, 0.854902f, 0.858824f, 0.858824f, 0.866667f, 0.870588f, 0.878431f, 0.882353f, 0.890196f, 0.898039f, 0.901961f, 0.901961f, 0.909804f, 0.917647f, 0.921569f, 0.921569f, 0.921569f, 0.929412f, 0.933333f, 0.933333f, 0.933333f, 0.941176f, 0.941176f, 0.945098f,
+    0.917647f, 0.886275f, 0.874510f, 0.862745f, 0.850980f, 0.839216f, 0.835294f, 0.835294f, 0.835294f, 0.835294f, 0.835294f, 0.839216f, 0.847059f, 0.854902f, 0.858824f, 0.858824f, 0.866667f, 0.874510f, 0.878431f, 0.878431f, 0.886275f, 0.894118f, 0.898039f, 0.901961f, 0.905882f, 0.909804f, 0.909804f, 0.909804f, 0.913725f, 0.921569f, 0.921569f, 0.925490f,
+    0.898039f, 0.878431f, 0.866667f, 0.854902f, 0.843137f, 0.835294f, 0.827451f, 0.823529f, 0.823529f, 0.823529f, 0.823529f, 0.827451f, 0.827451f, 0.827451f, 0.835294f, 0.835294f, 0.843137f, 0.850980f, 0.854902f, 0.858824f, 0.858824f, 0.862745f, 0.870588f, 0.874510f, 0.878431f, 0.882353f, 0.886275f, 0.890196f, 0.890196f, 0.898039f, 0.898039f, 0.901961f,
+    0.882353f, 0.874510f, 0.858824f, 0.847059f, 0.835294f, 0.827451f, 0.819608f, 0.811765f, 0.811765f, 0.807843f, 0.807843f, 0.807843f, 0.807843f, 0.807843f, 0.815686f, 0.815686f, 0.819608f, 0.827451f, 0.831373f, 0.835294f, 0.835294f, 0.839216f, 0.847059f, 0.850980f, 0.854902f, 0.858824f, 0.862745f, 0.866667f, 0.866667f, 0.870588f, 0.878431f, 0.878431f,
+    0.862745f, 0.866667f, 0.850980f, 0.835294f, 0.823529f, 0.815686f, 0.807843f, 0.803922f, 0.800000f, 0.792157f, 0.792157f, 0.788235f, 0.788235f, 0.788235f, 0.796078f, 0.796078f, 0.796078f, 0.803922f, 0.803922f, 0.803922f, 0.807843f, 0.807843f, 0.819608f, 0.823529f, 0.823529f, 0.831373f, 0.831373f, 0.831373f, 0.835294f, 0.839216f, 0.847059f, 0.850980f,
+    0.835294f, 0.858824f, 0.835294f, 0.823529f, 0.811765f, 0.803922f, 0.792157f, 0.788235f, 0.784314f, 0.780392f, 0.776471f, 0.772549f, 0.768627f, 0.768627f, 0.768627f, 0.768627f, 0.768627f, 0.772549f, 0.772549f, 0.776471f, 0.776471f, 0.780392f, 0.788235f, 0.792157f, 0.792157f, 0.792157f, 0.800000f, 0.803922f, 0.803922f, 0.811765f, 0.811765f, 0.815686f,
+    0.803922f, 0.847059f, 0.823529f, 0.811765f, 0.800000f, 0.788235f, 0.780392f, 0.772549f, 0.764706f, 0.760784f, 0.756863f, 0.752941f, 0.749020f, 0.745098f, 0.745098f, 0.741176f, 0.741176f, 0.745098f, 0.745098f, 0.745098f, 0.745098f, 0.752941f, 0.752941f, 0.752941f, 0.756863f, 0.756863f, 0.760784f, 0.768627f, 0.768627f, 0.768627f, 0.776471f, 0.776471f,
+    0.772549f, 0.839216f, 0.807843f, 0.796078f, 0.784314f, 0.772549f, 0.764706f, 0.752941f, 0.749020f, 0.741176f, 0.737255f, 0.733333f, 0.729412f, 0.725490f, 0.717647f, 0.717647f, 0.717647f, 0.717647f, 0.713725f, 0.713725f, 0.713725f, 0.717647f, 0.717647f, 0.717647f, 0.721569f, 0.721569f, 0.721569f, 0.721569f, 0.725490f, 0.729412f, 0.733333f, 0.733333f,
+    0.745098f, 0.827451f, 0.792157f, 0.776471f, 0.768627f, 0.756863f, 0.745098f, 0.737255f, 0.729412f, 0.721569f, 0.713725f, 0.709804f, 0.705882f, 0.701961f, 0.694118f, 0.690196f, 0.690196f, 0.690196f, 0.686275f, 0.686275f, 0.682353f, 0.682353f, 0.682353f, 0.682353f, 0.682353f, 0.682353f, 0.686275f, 0.686275f, 0.686275f, 0.690196f, 0.690196f, 0.690196f,
+    0.705882f, 0.807843f, 0.772549f, 0.760784f, 0.749020f, 0.737255f, 0.725490f, 0.717647f, 0.705882f, 0.698039f, 0.694118f, 0.686275f, 0.682353f, 0.674510f, 0.666667f, 0.662745f, 0.662745f, 0.658824f, 0.654902f, 0.654902f, 0.650980f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f, 0.647059f,
+    0.674510f, 0.792157f, 0.752941f, 0.741176f, 0.729412f, 0.717647f, 0.705882f, 0.694118f, 0.686275f, 0.678431f, 0.670588f, 0.662745f, 0.654902f, 0.650980f, 0.643137f, 0.635294f, 0.635294f, 0.631373f, 0.627451f, 0.623529f, 0.619608f, 0.615686f, 0.611765f, 0.611765f, 0.611765f, 0.607843f, 0.607843f, 0.607843f, 0.603922f, 0.603922f, 0.603922f, 0.603922f,
+    0.643137f, 0.776471f, 0.737255f, 0.721569f, 0.709804f, 0.698039f, 0.686275f, 0.674510f, 0.666667f, 0.654902f, 0.647059f, 0.639216f, 0.631373f, 0.627451f, 0.619608f, 0.615686f, 0.607843f, 0.603922f, 0.600000f, 0.596078f, 0.592157f, 0.588235f, 0.580392f, 0.576471f, 0.576471f, 0.576471f, 0.572549f, 0.572549f, 0.568627f, 0.564706f, 0.564706f, 0.564706f,
+    0.607843f, 0.760784f, 0.717647f, 0.701961f, 0.686275f, 0.674510f, 0.662745f, 0.650980f, 0.643137f, 0.631373f, 0.623529f, 0.611765f, 0.603922f, 0.596078f, 0.592157f, 0.584314f, 0.576471f, 0.572549f, 0.568627f, 0.560784f, 0.556863f, 0.552941f, 0.545098f, 0.537255f, 0.537255f, 0.537255f, 0.533333f, 0.533333f, 0.529412f, 0.525490f, 0.521569f, 0.521569f,
+    0.572549f, 0.741176f, 0.690196f, 0.674510f, 0.662745f, 0.647059f, 0.635294f, 0.623529f, 0.611765f, 0.603922f, 0.592157f, 0.584314f, 0.572549f, 0.564706f, 0.556863f, 0.549020f, 0.545098f, 0.537255f, 0.533333f, 0.525490f, 0.521569f, 0.513725f, 0.505882f, 0.501961f, 0.501961f, 0.498039f, 0.494118f, 0.490196f, 0.486275f, 0.482353f, 0.482353f, 0.482353f,
+    0.537255f, 0.717647f, 0.666667f, 0.647059f, 0.635294f, 0.623529f, 0.611765f, 0.600000f, 0.588235f, 0.576471f, 0.564706f, 0.556863f, 0.545098f, 0.537255f, 0.529412f, 0.521569f, 0.513725f, 0.505882f, 0.498039f, 0.494118f, 0.486275f, 0.482353f, 0.474510f, 0.466667f, 0.466667f, 0.462745f, 0.454902f, 0.450980f, 0.447059f, 0.443137f, 0.435294f, 0.435294f,
+    0.501961f, 0.698039f, 0.643137f, 0.623529f, 0.611765f, 0.596078f, 0.584314f, 0.572549f, 0.560784f, 0.549020f, 0.537255f, 0.525490f, 0.517647f, 0.509804f, 0.498039f, 0.490196f, 0.482353f, 0.474510f, 0.466667f, 0.462745f, 0.454902f, 0.447059f, 0.443137f, 0.435294f, 0.431373f, 0.427451f, 0.419608f, 0.415686f, 0.411765f, 0.407843f, 0.400000f, 0.392157f,
+    0.466667f, 0.674510f, 0.619608f, 0.596078f, 0.584314f, 0.568627f, 0.552941f, 0.541176f, 0.529412f, 0.517647f, 0.505882f, 0.494118f, 0.486275f, 0.478431f, 0.466667f, 0.458824f, 0.447059f, 0.439216f, 0.435294f, 0.427451f, 0.419608f, 0.411765f, 0.407843f, 0.400000f, 0.396078f, 0.388235f, 0.384314f, 0.376471f, 0.372549f, 0.368627f, 0.364706f, 0.356863f,
+    0.439216f, 0.654902f, 0.596078f, 0.572549f, 0.560784f, 0.545098f, 0.529412f, 0.517647f, 0.505882f, 0.494118f, 0.482353f, 0.470588f, 0.462745f, 0.450980f, 0.443137f, 0.431373f, 0.423529f, 0.415686f, 0.407843f, 0.400000f, 0.392157f, 0.384314f, 0.380392f, 0.372549f, 0.364706f, 0.360784f, 0.352941f, 0.349020f, 0.345098f, 0.337255f, 0.329412f, 0.325490f,
+};
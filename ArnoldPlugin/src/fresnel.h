@@ -0,0 +1,6 @@
+#pragma once
+
+// Unpolarized Fresnel reflectance. eta is the transmitted over incident IOR;
+// a negative cosTi flips the interface.
+float fresnelDielectric(float cosTi, float eta);
+float fresnelConductor(float CosTheta, float Eta, float Etak);
@@ -0,0 +1,161 @@
+#include "layer_graph.h"
+#include "layer_parser.h"
+#include <algorithm>
+#include <cstdio>
+#include <initializer_list>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+// Deeper graphs are surely cyclic, they are left to per-sample evaluation
+const int MAX_GRAPH_DEPTH = 64;
+
+bool anyLinked(const AtNode* node, std::initializer_list<const char*> params) {
+    for (const char* param : params) {
+        if (AiNodeIsLinked(node, param))
+            return true;
+    }
+    return false;
+}
+
+// Handles by their interned characters. Written in node_update/node_finish,
+// which Arnold doesn't run while shading, so lookups need no lock.
+std::mutex s_outputs_lock;
+std::unordered_map<const char*, const LayerOutput*> s_outputs;
+
+}
+
+void registerLayerOutput(const AtNode* node, LayerOutput& output) {
+    if (!output.handle.empty())
+        return;
+
+    // Parsed as text, e.g. after a string passthrough node, a handle must be
+    // skipped by parse_layer_stack: no record marker nor '{' may appear in it
+    std::string name = AiNodeGetName(node);
+    std::replace_if(name.begin(), name.end(), [](char c) { return c == LayerRecord::MARKER || c == '{'; }, '_');
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "#%p", (const void*)&output);
+    output.handle = AtString(("&" + name + suffix).c_str());
+
+    std::lock_guard<std::mutex> guard(s_outputs_lock);
+    s_outputs[output.handle.c_str()] = &output;
+}
+
+void unregisterLayerOutput(LayerOutput& output) {
+    if (output.handle.empty())
+        return;
+
+    std::lock_guard<std::mutex> guard(s_outputs_lock);
+    s_outputs.erase(output.handle.c_str());
+}
+
+bool appendLayers(const AtString& value, const AtShaderGlobals* sg, LayerRecordList& list) {
+    const char* str = value.c_str();
+    if (*str == '&') {
+        auto it = s_outputs.find(str);
+        const LayerRecordList* layers = it != s_outputs.end() ? it->second->lists[sg->tid] : nullptr;
+        if (layers)
+            list.append(*layers);
+        return !list.truncated;
+    }
+
+    // not one of our nodes, or a hand-written string
+    return parse_layer_records(str, list);
+}
+
+void setFolded(FoldedString& folded, bool constant, const std::string& records) {
+    folded.constant = constant;
+    folded.value = constant ? AtString(records.c_str()) : AtString();
+    folded.records = LayerRecordList();
+    if (constant)
+        parse_layer_records(records.c_str(), folded.records);
+}
+
+bool foldLayerNode(const AtNode* node, LayerRecord& layer) {
+    if (AiNodeIs(node, AtString("layerstack_metal"))) {
+        if (anyLinked(node, { "albedo", "IOR", "kappa", "roughness" }))
+            return false;
+        layer.albedo = AiNodeGetRGB(node, AtString("albedo"));
+        layer.eta = AiNodeGetFlt(node, AtString("IOR"));
+        layer.kappa = AiNodeGetFlt(node, AtString("kappa"));
+        layer.alpha = AiNodeGetFlt(node, AtString("roughness"));
+        return true;
+    }
+    if (AiNodeIs(node, AtString("layerstack_dielectric"))) {
+        if (anyLinked(node, { "IOR", "roughness" }))
+            return false;
+        layer.eta = AiNodeGetFlt(node, AtString("IOR"));
+        layer.alpha = AiNodeGetFlt(node, AtString("roughness"));
+        return true;
+    }
+    if (AiNodeIs(node, AtString("layerstack_volumetric"))) {
+        if (anyLinked(node, { "albedo", "depth", "g" }))
+            return false;
+        layer.albedo = AiNodeGetRGB(node, AtString("albedo"));
+        layer.depth = AiNodeGetFlt(node, AtString("depth"));
+        layer.g = AiNodeGetFlt(node, AtString("g"));
+        return true;
+    }
+    return false;
+}
+
+bool foldLayerGraph(const AtNode* node, std::string& records, int depth) {
+    if (!node || depth > MAX_GRAPH_DEPTH)
+        return false;
+
+    if (AiNodeIs(node, AtString("layerstack_add"))) {
+        return foldLayerInput(node, "top", records, depth + 1)
+            && foldLayerInput(node, "bottom", records, depth + 1);
+    }
+
+    LayerRecord layer;
+    if (!foldLayerNode(node, layer))
+        return false;
+    records += layer.toString().c_str();
+    return true;
+}
+
+bool foldLayerInput(const AtNode* node, const char* param, std::string& records, int depth) {
+    if (!AiNodeIsLinked(node, param)) {
+        records += AiNodeGetStr(node, AtString(param)).c_str();
+        return true;
+    }
+
+    // only whole outputs of our own nodes can be folded
+    int comp = -1;
+    const AtNode* source = AiNodeGetLink(node, param, &comp);
+    if (comp != -1)
+        return false;
+    return foldLayerGraph(source, records, depth);
+}
+
+int readLayerArrays(const AtNode* node, std::string& records) {
+    const AtArray* albedos = AiNodeGetArray(node, AtString("layer_albedo"));
+    const AtArray* etas = AiNodeGetArray(node, AtString("layer_eta"));
+    const AtArray* kappas = AiNodeGetArray(node, AtString("layer_kappa"));
+    const AtArray* roughnesses = AiNodeGetArray(node, AtString("layer_roughness"));
+    const AtArray* depths = AiNodeGetArray(node, AtString("layer_depth"));
+    const AtArray* gs = AiNodeGetArray(node, AtString("layer_g"));
+
+    const auto size = [](const AtArray* array) { return array ? AiArrayGetNumElements(array) : 0u; };
+    const uint32_t count = std::max({ size(albedos), size(etas), size(kappas), size(roughnesses), size(depths), size(gs) });
+
+    for (uint32_t i = 0; i < count; ++i) {
+        LayerRecord layer;
+        if (i < size(albedos))
+            layer.albedo = AiArrayGetRGB(albedos, i);
+        if (i < size(etas))
+            layer.eta = AiArrayGetFlt(etas, i);
+        if (i < size(kappas))
+            layer.kappa = AiArrayGetFlt(kappas, i);
+        if (i < size(roughnesses))
+            layer.alpha = AiArrayGetFlt(roughnesses, i);
+        if (i < size(depths))
+            layer.depth = AiArrayGetFlt(depths, i);
+        if (i < size(gs))
+            layer.g = AiArrayGetFlt(gs, i);
+        records += layer.toString().c_str();
+    }
+    return (int)count;
+}
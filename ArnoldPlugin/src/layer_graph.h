@@ -0,0 +1,76 @@
+#pragma once
+#include <ai.h>
+#include <new>
+#include <string>
+#include "layer_record.h"
+
+// Constant folding of the layerstack_* node graphs, done in node_update so
+// that subgraphs without varying inputs aren't evaluated per sample. The
+// graph is read from the parameter values and links, so it doesn't depend
+// on the order in which Arnold updates the nodes.
+
+// Output of a string node once folded, kept in its local data. The records
+// are also kept decoded for the nodes that combine it with varying layers.
+struct FoldedString
+{
+    bool constant = false;
+    AtString value;
+    LayerRecordList records;
+};
+
+// Output of a layerstack_* node evaluated per sample. The layers of the
+// sample go to a list allocated from the shader globals, and the node
+// outputs `handle`: a string interned once in node_update that names this
+// output. Nothing is formatted, parsed or interned per sample; the consumer
+// resolves the handle and reads the list its thread just produced.
+struct LayerOutput
+{
+    AtString handle;
+    const LayerRecordList* lists[AI_MAX_THREADS] = {};   // by sg->tid
+
+    // Empty list for the sample, output through the handle
+    LayerRecordList* emit(AtShaderGlobals* sg) {
+        LayerRecordList* list = new (AiShaderGlobalsQuickAlloc(sg, sizeof(LayerRecordList))) LayerRecordList;
+        lists[sg->tid] = list;
+        sg->out.STR() = handle;
+        return list;
+    }
+};
+
+// Local data of the metal, dielectric and volumetric nodes
+struct LayerLeafData
+{
+    FoldedString folded;
+    LayerOutput output;
+};
+
+// Names output with a handle and makes it resolvable, from node_update.
+// Handles are only registered between renders, the lookups at shade time
+// don't lock.
+void registerLayerOutput(const AtNode* node, LayerOutput& output);
+void unregisterLayerOutput(LayerOutput& output);
+
+// Appends the layers of a string input evaluated at shade time: the handle
+// of a layerstack_* node, or records and legacy text from any other node.
+// Returns false when layers were dropped past MLS_MAX_LAYERS.
+bool appendLayers(const AtString& value, const AtShaderGlobals* sg, LayerRecordList& list);
+
+// Sets folded to the given records when constant, empty otherwise
+void setFolded(FoldedString& folded, bool constant, const std::string& records);
+
+// Reads the layer of a layerstack_metal, _dielectric or _volumetric node.
+// Returns false for other nodes, or when one of its inputs is linked.
+bool foldLayerNode(const AtNode* node, LayerRecord& layer);
+
+// Appends the layer records output by node to records. Returns false when
+// its subgraph has a varying input, records is then left incomplete.
+bool foldLayerGraph(const AtNode* node, std::string& records, int depth = 0);
+
+// Same for the parameter `param` of node: the upstream graph when linked,
+// the string value otherwise
+bool foldLayerInput(const AtNode* node, const char* param, std::string& records, int depth = 0);
+
+// Appends the layers given by the layer_* array parameters of a layerstack
+// node, one element per layer top to bottom. Shorter arrays leave the layer
+// defaults. Returns the number of layers, 0 when the arrays are empty.
+int readLayerArrays(const AtNode* node, std::string& records);
@@ -0,0 +1,132 @@
+#include "layer_parser.h"
+#include <cstring>
+
+std::vector<std::string> split(const std::string& str, const std::string& delimiter) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    size_t end = str.find(delimiter);
+    while (end != std::string::npos) {
+        parts.push_back(str.substr(start, end - start));
+        start = end + delimiter.length();
+        end = str.find(delimiter, start);
+    }
+    parts.push_back(str.substr(start));  // remaining last part
+    return parts;
+}
+
+MaterialParam parse_param(const std::string& param_str) {
+    MaterialParam param;
+
+    size_t sep = param_str.find('=');
+    if (sep == std::string::npos)
+        return param; // empty param
+
+    param.key = param_str.substr(0, sep);
+    std::string value_str = param_str.substr(sep + 1);
+
+    if (param.key == "albedo") {
+        // value looks like "0.3,0.4,0.5"
+        std::vector<std::string> comps = split(value_str, ",");
+        for (const std::string& s : comps) {
+            param.values.push_back(std::stof(s));
+        }
+    }
+    else {
+        // a single float
+        param.values.push_back(std::stof(value_str));
+    }
+
+    return param;
+}
+
+// Fills a layer from the body of a legacy "{key=value;...}" layer
+static void parse_layer(const std::string& layer_str, LayerRecord& layer) {
+    std::vector<std::string> params_layer = split(layer_str, ";");
+    for (const std::string& p : params_layer) {
+        MaterialParam mp = parse_param(p);
+        if (mp.key == "albedo") {
+            layer.albedo.r = mp.values[0];
+            layer.albedo.g = mp.values[1];
+            layer.albedo.b = mp.values[2];
+        }
+        else if (mp.key == "eta") {
+            layer.eta = mp.values[0];
+        }
+        else if (mp.key == "kappa") {
+            layer.kappa = mp.values[0];
+        }
+        else if (mp.key == "alpha") {
+            layer.alpha = mp.values[0];
+        }
+        else if (mp.key == "depth") {
+            layer.depth = mp.values[0];
+        }
+        else if (mp.key == "g") {
+            layer.g = mp.values[0];
+        }
+    }
+}
+
+bool add_layer(const LayerRecord& layer, LayerStackBSDF& lsbsdf) {
+    AtRGB sigma_a(0.0);
+    AtRGB sigma_s(0.0);
+    float eta = layer.eta;
+    float alpha = layer.alpha;
+    if (layer.depth > 0.0) {
+        computeSigma(layer.albedo, 1.0, sigma_a, sigma_s);
+        alpha = gToVariance(layer.g);
+        eta = lsbsdf.lastEta();
+    }
+
+    return lsbsdf.addLayer(layer.albedo, eta, layer.kappa, alpha, layer.depth, sigma_a, sigma_s);
+}
+
+bool add_layers(const LayerRecordList& list, LayerStackBSDF& lsbsdf) {
+    for (int i = 0; i < list.count; ++i) {
+        if (!add_layer(list.records[i], lsbsdf))
+            return false;
+    }
+    return !list.truncated;
+}
+
+// Calls add(layer) for every layer of paramstr, stops when it returns false
+template<typename Add>
+static bool for_each_layer(const char* paramstr, Add add) {
+    // Binary records from the layerstack_* nodes and legacy text layers can
+    // be mixed, e.g. a hand-written string on one side of an add node
+    const char* p = paramstr;
+    while (*p) {
+        LayerRecord layer;
+        if (*p == LayerRecord::MARKER) {
+            if (strnlen(p, LayerRecord::SIZE) < (size_t)LayerRecord::SIZE || !layer.decode(p)) {
+                AiMsgWarning("[layerstack] malformed layer record, the layers below are ignored");
+                return true;
+            }
+            p += LayerRecord::SIZE;
+        }
+        else if (*p == '{') {
+            const char* end = strchr(p, '}');
+            const size_t len = end ? end - p - 1 : strlen(p + 1);
+            parse_layer(std::string(p + 1, len), layer);
+            p += len + 1 + (end ? 1 : 0);
+        }
+        else {
+            ++p;
+            continue;
+        }
+
+        if (!add(layer))
+            return false;
+    }
+
+    return true;
+}
+
+bool parse_layer_stack(const char* paramstr, LayerStackBSDF& lsbsdf) {
+    return for_each_layer(paramstr, [&lsbsdf](const LayerRecord& layer) { return add_layer(layer, lsbsdf); });
+}
+
+bool parse_layer_records(const char* paramstr, LayerRecordList& list) {
+    for_each_layer(paramstr, [&list](const LayerRecord& layer) { list.append(layer); return true; });
+    return !list.truncated;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "mls_bsdf.h"
+#include "layer_record.h"
+#include <string>
+#include <vector>
+
+struct MaterialParam {
+    std::string key;
+    std::vector<float> values;
+};
+
+std::vector<std::string> split(const std::string& str, const std::string& delimiter);
+
+MaterialParam parse_param(const std::string& param_str);
+
+// Appends a layer below the ones of lsbsdf. Volumetric layers get their
+// scattering coefficients here and inherit the IOR of the layer above.
+// Returns false once the stack is full.
+bool add_layer(const LayerRecord& layer, LayerStackBSDF& lsbsdf);
+
+// Appends the layers of list below the ones of lsbsdf.
+// Returns false if the stack had more than MLS_MAX_LAYERS layers.
+bool add_layers(const LayerRecordList& list, LayerStackBSDF& lsbsdf);
+
+// Parses a stack of layer records (layer_record.h) and/or legacy
+// "{key=value;...}{key=value;...}" text layers into lsbsdf.
+// Returns false if the stack had more than MLS_MAX_LAYERS layers.
+bool parse_layer_stack(const char* paramstr, LayerStackBSDF& lsbsdf);
+
+// Same, appending the decoded layers to list instead
+bool parse_layer_records(const char* paramstr, LayerRecordList& list);
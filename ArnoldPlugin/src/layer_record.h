@@ -0,0 +1,96 @@
+#pragma once
+#include <ai.h>
+#include <cstdint>
+#include <cstring>
+#include "mls_bsdf.h"
+
+// Parameters of one layer as handed from the layerstack_* leaf nodes to the
+// root node. A record is a marker followed by the raw bits of its floats in
+// hex, so values go through the node graph exactly and the AtString stays
+// printable (no NUL bytes). The add node concatenates records top to bottom.
+struct LayerRecord
+{
+    static const char MARKER = '@';
+    static const int NB_FLOATS = 8;
+    static const int SIZE = 1 + NB_FLOATS * 8;   // chars, without terminator
+
+    AtRGB albedo = AtRGB(1.0f, 1.0f, 1.0f);
+    float eta = 1.0f;
+    float kappa = 0.0f;
+    float alpha = 0.0f;
+    float depth = 0.0f;   // > 0 for volumetric layers
+    float g = 0.0f;
+
+    // Writes SIZE chars to out, no terminator
+    void encode(char* out) const {
+        static const char digits[] = "0123456789abcdef";
+        const float values[NB_FLOATS] = { albedo.r, albedo.g, albedo.b, eta, kappa, alpha, depth, g };
+        *out++ = MARKER;
+        for (float v : values) {
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            for (int shift = 28; shift >= 0; shift -= 4)
+                *out++ = digits[(bits >> shift) & 0xf];
+        }
+    }
+
+    // Reads SIZE chars from in, returns false on a malformed record
+    bool decode(const char* in) {
+        if (*in++ != MARKER)
+            return false;
+        float values[NB_FLOATS];
+        for (float& v : values) {
+            uint32_t bits = 0;
+            for (int k = 0; k < 8; ++k) {
+                const char c = *in++;
+                uint32_t digit;
+                if (c >= '0' && c <= '9')
+                    digit = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    digit = c - 'a' + 10;
+                else
+                    return false;
+                bits = (bits << 4) | digit;
+            }
+            memcpy(&v, &bits, sizeof(v));
+        }
+        albedo = AtRGB(values[0], values[1], values[2]);
+        eta = values[3];
+        kappa = values[4];
+        alpha = values[5];
+        depth = values[6];
+        g = values[7];
+        return true;
+    }
+
+    // Single-record AtString, the output of the leaf nodes once folded
+    AtString toString() const {
+        char buffer[SIZE + 1];
+        encode(buffer);
+        buffer[SIZE] = '\0';
+        return AtString(buffer);
+    }
+};
+
+// Decoded layers of a stack, top to bottom. What the layerstack_* nodes hand
+// to each other per sample, so nothing is formatted or parsed at shade time.
+struct LayerRecordList
+{
+    LayerRecord records[MLS_MAX_LAYERS];
+    int count = 0;
+    bool truncated = false;   // layers past MLS_MAX_LAYERS were dropped
+
+    void append(const LayerRecord& layer) {
+        if (count < MLS_MAX_LAYERS)
+            records[count++] = layer;
+        else
+            truncated = true;
+    }
+
+    void append(const LayerRecordList& other) {
+        const int n = std::min(other.count, MLS_MAX_LAYERS - count);
+        memcpy(records + count, other.records, n * sizeof(LayerRecord));
+        count += n;
+        truncated = truncated || other.truncated || n < other.count;
+    }
+};
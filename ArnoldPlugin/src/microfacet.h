@@ -1,7 +1,7 @@
 #pragma once
 #include <ai.h>
 
-float distributionGGX(float cosTheta, float alpha)
+inline float distributionGGX(float cosTheta, float alpha)
 {
     if (cosTheta < 1e-6f)
         return 0.0f;
@@ -14,21 +14,77 @@ float distributionGGX(float cosTheta, float alpha)
     return nom / denom;
 }
 
-AtVector sampleGGX(AtVector2 rng, float alpha)
+// Samples a half vector from the GGX visible normals of wo, both in the local
+// frame (Heitz 2018, "Sampling the GGX Distribution of Visible Normals"). m
+// follows D(m) G1(wo) max(0, wo.m) / cos_o, so the reflected direction has the
+// pdf D(m) G1(wo) / (4 cos_o) with the exact Smith G1 below. Unlike sampling
+// D(m) cos_m, m never faces away from wo.
+inline AtVector sampleGGXVNDF(const AtVector& wo, AtVector2 rng, float alpha)
 {
-    AtVector2 p = ToConcentricDisk(rng);
-    AtVector wh = AtVector(p.x, p.y, sqrtf(1.f - AiV2Dot(p, p)));
-    return AiV3Normalize(wh * AtVector(alpha, alpha, 1.f));
+    // Stretch the view so the distribution becomes the unit hemisphere
+    const AtVector Vh = AiV3Normalize(AtVector(alpha * wo.x, alpha * wo.y, wo.z));
+
+    // Orthonormal basis around Vh
+    const float lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+    const AtVector T1 = lensq > 0.0f ? AtVector(-Vh.y, Vh.x, 0.0f) / sqrtf(lensq) : AtVector(1.0f, 0.0f, 0.0f);
+    const AtVector T2 = AiV3Cross(Vh, T1);
+
+    // Uniform disk, warped onto the part of the hemisphere visible from Vh
+    const float r = sqrtf(rng.x);
+    const float phi = 2.0f * AI_PI * rng.y;
+    const float t1 = r * cosf(phi);
+    const float s = 0.5f * (1.0f + Vh.z);
+    const float t2 = (1.0f - s) * sqrtf(1.0f - t1 * t1) + s * r * sinf(phi);
+
+    // Project back onto the hemisphere and unstretch
+    const AtVector Nh = t1 * T1 + t2 * T2 + sqrtf(std::max(0.0f, 1.0f - t1 * t1 - t2 * t2)) * Vh;
+    return AiV3Normalize(AtVector(alpha * Nh.x, alpha * Nh.y, std::max(0.0f, Nh.z)));
+}
+
+// Exact Smith masking of GGX, the normalization of the visible normals. The
+// Schlick approximation below stays in the BRDF itself.
+inline float smithG1GGX(float cosTheta, float alpha)
+{
+    const float a2 = alpha * alpha;
+    return 2.0f * cosTheta / (cosTheta + sqrtf(a2 + (1.0f - a2) * cosTheta * cosTheta));
 }
 
-float smithShlickGGX(float cosTheta, float alpha)
+inline float smithShlickGGX(float cosTheta, float alpha)
 {
     float k = alpha * 0.5f;
     return cosTheta / (cosTheta * (1.0f - k) + k);
 }
 
-float geometrySmith(float cosThetaO, float cosThetaI, float alpha)
+inline float geometrySmith(float cosThetaO, float cosThetaI, float alpha)
 {
     return smithShlickGGX(std::abs(cosThetaO), alpha) * smithShlickGGX(std::abs(cosThetaI), alpha);
 }
 
+// Batched form of the functions above for n lobes seen from the same geometry,
+// with the roughnesses packed in alphas. Computes for every lobe
+//   D = distributionGGX(cosNH, alpha)
+//   G = geometrySmith(cosNO, cosNI, alpha)
+// The loop has no branches or early outs so the compiler vectorizes it across
+// lobes; callers mask lobes out of the result rather than skipping them.
+inline void evalGGXLobes(int n, const float* alphas, float cosNH, float cosNI, float cosNO, float* D, float* G)
+{
+    const float cosNH2 = cosNH * cosNH;
+    const float absNI = std::abs(cosNI);
+    const float absNO = std::abs(cosNO);
+    const bool above = cosNH >= 1e-6f;
+
+    for (int i = 0; i < n; ++i) {
+        const float a = alphas[i];
+        const float a2 = a * a;
+        const float denom = cosNH2 * (a2 - 1.0f) + 1.0f;
+        // a smooth lobe (alpha = 0) at cosNH = 1 is 0 / 0, keep it finite so
+        // masking it with a zero weight still works
+        const float d = a2 / std::max(denom * denom * AI_PI, 1e-30f);
+        D[i] = above ? d : 0.0f;
+
+        const float k = a * 0.5f;
+        const float gi = absNI / (absNI * (1.0f - k) + k);
+        const float go = absNO / (absNO * (1.0f - k) + k);
+        G[i] = gi * go;
+    }
+}
@@ -1,4 +1,7 @@
 #include <ai.h>
+#include <string>
+#include "layer_record.h"
+#include "layer_graph.h"
 
 AI_SHADER_NODE_EXPORT_METHODS(MLSAddNodeMtd);
 
@@ -13,29 +16,67 @@ node_parameters
     AiParameterStr("bottom", "");
 }
 
+// Folded inputs, and the output when both of them are constant
+struct AddNodeData {
+    FoldedString top;
+    FoldedString bottom;
+    FoldedString out;
+    LayerOutput output;
+};
+
+static void foldInput(const AtNode* node, const char* param, FoldedString& folded)
+{
+    std::string records;
+    const bool constant = foldLayerInput(node, param, records);
+    setFolded(folded, constant, records);
+}
+
+static void appendInput(const FoldedString& folded, AtString varying, const AtShaderGlobals* sg, LayerRecordList& list)
+{
+    if (folded.constant)
+        list.append(folded.records);
+    else
+        appendLayers(varying, sg, list);
+}
+
 node_initialize
 {
+    AiNodeSetLocalData(node, new AddNodeData);
 }
 
 node_update
 {
+    // Only the inputs with varying layers are evaluated per sample
+    AddNodeData* data = (AddNodeData*)AiNodeGetLocalData(node);
+    foldInput(node, "top", data->top);
+    foldInput(node, "bottom", data->bottom);
+
+    const bool constant = data->top.constant && data->bottom.constant;
+    setFolded(data->out, constant, constant ? std::string(data->top.value.c_str()) + data->bottom.value.c_str() : std::string());
+    registerLayerOutput(node, data->output);
 }
 
 node_finish
 {
+    AddNodeData* data = (AddNodeData*)AiNodeGetLocalData(node);
+    unregisterLayerOutput(data->output);
+    delete data;
+    AiNodeSetLocalData(node, nullptr);
 }
 
 shader_evaluate
 {
-    AtString top = AiShaderEvalParamStr(p_top);
-    AtString bottom = AiShaderEvalParamStr(p_bottom);
-
-    std::string topstd(top.c_str());
-    std::string bottomstd(bottom.c_str());
-
-    std::string outstd = topstd + bottomstd;
-
-    AtString out(outstd.c_str());
+    AddNodeData* data = (AddNodeData*)AiNodeGetLocalData(node);
+    if (data->out.constant) {
+        sg->out.STR() = data->out.value;
+        return;
+    }
 
-    sg->out.STR() = out;
+    // Inputs are evaluated before the output list is taken: the upstream
+    // nodes write their own lists, which stay valid until the sample ends
+    const AtString top = data->top.constant ? AtString() : AiShaderEvalParamStr(p_top);
+    const AtString bottom = data->bottom.constant ? AtString() : AiShaderEvalParamStr(p_bottom);
+    LayerRecordList* list = data->output.emit(sg);
+    appendInput(data->top, top, sg, *list);
+    appendInput(data->bottom, bottom, sg, *list);
 }
@@ -1,10 +1,51 @@
 #include "mls_bsdf.h"
+#include "angular_table.h"
 #include "microfacet.h"
 #include "util.h"
-#include "randoms.h"
+#include <algorithm>
+#include <cstdio>
+
+#if MLS_ENABLE_SAMPLE_STATS
+#include <atomic>
+
+static std::atomic<uint64_t> s_samples(0);
+static std::atomic<uint64_t> s_rejected(0);
+
+SampleStats takeSampleStats()
+{
+    SampleStats stats;
+    stats.samples = s_samples.exchange(0);
+    stats.rejected = s_rejected.exchange(0);
+    return stats;
+}
+
+#define MLS_COUNT_SAMPLE() s_samples.fetch_add(1, std::memory_order_relaxed)
+#define MLS_COUNT_REJECTED() s_rejected.fetch_add(1, std::memory_order_relaxed)
+#else
+#define MLS_COUNT_SAMPLE()
+#define MLS_COUNT_REJECTED()
+#endif
 
 AI_BSDF_EXPORT_METHODS(LayerStackBSDFMtd);
 
+/* One glossy reflection lobe per interface, top to bottom, so light path
+   expressions can tell them apart: <RS'layer0'> is the top coat. Lobes are
+   registered in bsdf_init for the interfaces the stack actually has */
+static const AtBSDFLobeInfo* lobeInfos()
+{
+    static const struct LobeInfos {
+        AtBSDFLobeInfo infos[MLS_MAX_LAYERS];
+        LobeInfos() {
+            static char labels[MLS_MAX_LAYERS][16];
+            for (int i = 0; i < MLS_MAX_LAYERS; ++i) {
+                snprintf(labels[i], sizeof(labels[i]), "layer%d", i);
+                infos[i] = { AI_RAY_SPECULAR_REFLECT, 0, AtString(labels[i]) };
+            }
+        }
+    } lobes;
+    return lobes.infos;
+}
+
 bsdf_init
 {
     LayerStackBSDF* data = (LayerStackBSDF*)AiBSDFGetData(bsdf);
@@ -17,186 +58,204 @@ bsdf_init
 
     data->N = sg->Nf;
     data->wo = -sg->Rd;
-    
-    // initialize the BSDF lobes. in this case we just have a single
-    // diffuse lobe with no specific flags or label
-    static const AtBSDFLobeInfo lobe_info[1] = { 
-        {AI_RAY_SPECULAR_REFLECT, 0, AtString()}
 
-    };
-    AiBSDFInitLobes(bsdf, lobe_info, 1);
+    // one lobe per interface. The set doesn't depend on wo, lobes that carry
+    // no energy at this shading point are simply never sampled
+    AiBSDFInitLobes(bsdf, lobeInfos(), std::max(data->nb_layers, 1));
     
     // specify that we will only reflect light in the hemisphere around N
     AiBSDFInitNormal(bsdf, data->N, true);
-}
 
-bsdf_sample
-{
-    LayerStackBSDF* data = (LayerStackBSDF*)AiBSDFGetData(bsdf);
+    // wo is fixed for the shading point, so the local frame and the
+    // adding-doubling coefficients are shared by every sample and eval call
+    AiV3BuildLocalFrame(data->U, data->V, data->N);
+
+    data->cosNO = AiV3Dot(data->N, data->wo);
+    data->nb_valid = 0;
+    data->cum_w = 0.0f;
 
     // discard rays below the hemisphere
-    const float cosNO = AiV3Dot(data->N, data->wo);
-    if (cosNO <= 0.f)
-        return AI_BSDF_LOBE_MASK_NONE;
+    if (data->cosNO <= 0.f)
+        return;
 
-    // compute coeffs and alphas using adding-doubling
-    AtRGB coeffs[10];
-    float alphas[10];
-    int nb_valid = 0;
-    computeAddingDoubling(cosNO, fmin(data->albedos.size(), 10), data->albedos, data->etas, data->kappas, data->alphas, data->depths, data->sigma_a, data->sigma_s,
-        coeffs, alphas, nb_valid);
+    // compute coeffs and alphas using adding-doubling, or the node's angular table
+    if (data->table) {
+        data->table->lookup(data->cosNO, data->coeffs, data->lobe_alphas, data->nb_valid);
+    }
+    else {
+        computeAddingDoubling(data->cosNO, data->nb_layers, data->albedos, data->etas, data->kappas, data->alphas, data->depths, data->sigma_a, data->sigma_s,
+            data->coeffs, data->lobe_alphas, data->nb_valid);
+    }
 
-    if (nb_valid == 0) {
-        return AI_BSDF_LOBE_MASK_NONE;
+    /* Convert Spectral coefficients to floats to select BRDF lobe to sample.
+       Lobes without energy are zeroed once here, so sample and eval can run
+       over every lobe without testing them */
+    float weights[MLS_MAX_LAYERS];
+    for (int i = 0; i < data->nb_valid; ++i) {
+        if (AiColorIsSmall(data->coeffs[i]))
+            data->coeffs[i] = AI_RGB_BLACK;
+        weights[i] = average(data->coeffs[i]);
+        data->cum_w += weights[i];
+    }
+
+    if (data->cum_w <= 0.0f) {
+        data->nb_valid = 0;
+        return;
+    }
+
+    // Lobe selection CDF, and the normalization of the visible normals of wo
+    // that turns D into the pdf of each lobe
+    const float inv_cum_w = 1.0f / data->cum_w;
+    const float inv4cosNO = 0.25f / data->cosNO;
+    float cdf = 0.0f;
+    for (int i = 0; i < data->nb_valid; ++i) {
+        data->sel_prob[i] = weights[i] * inv_cum_w;
+        cdf += data->sel_prob[i];
+        data->cdf[i] = cdf;
+        data->pdf_scale[i] = smithG1GGX(data->cosNO, data->lobe_alphas[i]) * inv4cosNO;
     }
+    data->cdf[data->nb_valid - 1] = 1.0f;
+}
 
-    /* Convert Spectral coefficients to floats to select BRDF lobe to sample */
-    std::vector<float> weights(nb_valid);
-    float cum_w = 0.0;
+// Mask of the lobes that can be sampled at this shading point
+static inline AtBSDFLobeMask validLobes(const LayerStackBSDF* data)
+{
+    return (AtBSDFLobeMask)((1ull << data->nb_valid) - 1);
+}
+
+/* f and pdf of every lobe in lobe_mask, for a half vector at cosNH from the
+   normal. Shared by sample and eval so both agree exactly. Returns the lobes
+   with a usable sample: NaN or overflowing f, or a pdf too small, are left out */
+static inline AtBSDFLobeMask evalLobes(const LayerStackBSDF* data, AtBSDFLobeMask lobe_mask, float cosNH, float cosNI, AtBSDFLobeSample out_lobes[])
+{
+    const int nb_valid = data->nb_valid;
+
+    // Microfacet terms of every lobe at once
+    float D[MLS_MAX_LAYERS], G[MLS_MAX_LAYERS];
+    evalGGXLobes(nb_valid, data->lobe_alphas, cosNH, cosNI, data->cosNO, D, G);
+
+    /* Every lobe is computed, unrequested or degenerate ones are masked with
+       a select and left out of the mask arithmetically, so the loop has no
+       branches. Arnold only reads the lobes of the returned mask */
+    const float inv4cosNO = 0.25f / data->cosNO;
+    AtBSDFLobeMask out_mask = AI_BSDF_LOBE_MASK_NONE;
     for (int i = 0; i < nb_valid; ++i) {
-        weights[i] = average(coeffs[i]);
-        cum_w += weights[i];
+        const AtRGB f = (D[i] * G[i] * inv4cosNO) * data->coeffs[i];
+        const float pdf = data->pdf_scale[i] * D[i];
+        const bool usable = ((lobe_mask >> i) & 1u) && pdf > 1e-6f && !isInvalid(f) && average(f) <= 1e8f;
+        const AtRGB weight = f / std::max(pdf, 1e-6f);
+        out_lobes[i] = AtBSDFLobeSample(usable ? weight : AI_RGB_BLACK, 0, usable ? pdf : 0.0f);
+        out_mask |= (AtBSDFLobeMask)usable << i;
+    }
+
+    return out_mask;
+}
+
+bsdf_sample
+{
+    LayerStackBSDF* data = (LayerStackBSDF*)AiBSDFGetData(bsdf);
+    MLS_COUNT_SAMPLE();
+
+    // nothing to sample below the hemisphere, without valid interfaces or
+    // when none of the requested lobes carry energy
+    const AtBSDFLobeMask mask = lobe_mask & validLobes(data);
+    if (mask == AI_BSDF_LOBE_MASK_NONE) {
+        MLS_COUNT_REJECTED();
+        return AI_BSDF_LOBE_MASK_NONE;
     }
 
-    /* Select a random BRDF lobe */
-    float sel_w = rand1() * cum_w - weights[0];
+    const float cosNO = data->cosNO;
+    const int nb_valid = data->nb_valid;
+
+    /* Select a BRDF lobe by counting the CDF entries below rnd.z, branch free.
+       rnd.z is the sample dimension Arnold provides for lobe selection, so the
+       choice is stratified and deterministic. The last entry is 1 and rnd.z < 1,
+       so the last lobe never needs a test */
     int sel_i = 0;
-    for (sel_i = 0; sel_w > 0.0 && sel_i < nb_valid; sel_i++) {
-        sel_w -= weights[sel_i + 1];
+    float sel_prob;
+    if (mask == validLobes(data)) {
+        for (int i = 0; i < nb_valid - 1; ++i) {
+            sel_i += rnd.z >= data->cdf[i];
+        }
+        sel_prob = data->sel_prob[sel_i];
+    }
+    else {
+        // Arnold asked for a subset of the lobes: renormalize over it
+        float masked_w = 0.0f;
+        for (int i = 0; i < nb_valid; ++i) {
+            masked_w += (mask & LobeMask(i)) ? data->sel_prob[i] : 0.0f;
+        }
+        if (masked_w <= 0.0f) {
+            MLS_COUNT_REJECTED();
+            return AI_BSDF_LOBE_MASK_NONE;
+        }
+        const float z = rnd.z * masked_w;
+        float cdf = 0.0f;
+        sel_i = -1;
+        for (int i = 0; i < nb_valid; ++i) {
+            if (!(mask & LobeMask(i)))
+                continue;
+            sel_i = i;
+            cdf += data->sel_prob[i];
+            if (z < cdf)
+                break;
+        }
+        sel_prob = data->sel_prob[sel_i] / masked_w;
     }
 
-    // compute wi
-    AtVector m = sampleGGX(rnd, alphas[sel_i]);
-    AtVector U, V;
-    AiV3BuildLocalFrame(U, V, data->N);
-    AtVector m_World = m.x * U + m.y * V + m.z * data->N;
+    // compute wi from the visible normals of the selected lobe
+    const AtVector wo_local(AiV3Dot(data->wo, data->U), AiV3Dot(data->wo, data->V), cosNO);
+    AtVector m = sampleGGXVNDF(wo_local, rnd, data->lobe_alphas[sel_i]);
+    AtVector m_World = m.x * data->U + m.y * data->V + m.z * data->N;
     AtVector wi = reflect(data->wo, m_World);
     const float cosNI = AiV3Dot(data->N, wi);
 
     if (cosNI <= 0.0f) {
+        MLS_COUNT_REJECTED();
         return AI_BSDF_LOBE_MASK_NONE;
     }
-    
-    // F
-    AtRGB f(0.0f, 0.0f, 0.0f);
-
-    /* Evaluate the MIS 'pdf' using the balance heuristic */
-    float pdf = 0.0;
-    for (int i = 0; i < nb_valid; ++i) {
-        // Fetch current roughness
-        const float a = alphas[i];
-
-        // Evaluate microfacet model
-        const float D = distributionGGX(AiV3Dot(data->N, m_World), a);
-        const float G = geometrySmith(cosNI, cosNO, a);
-        const float G1 = smithShlickGGX(cosNI, a);
-
-        if (!AiColorIsSmall(coeffs[i])) {
-            // f
-            f += D * G * coeffs[i] / (4.0f * cosNO);
-            // pdf
-            float DG1 = D * G1 / (4.0f * cosNO);
-            pdf += (weights[i] / cum_w) * DG1;
-        }
-    }
 
-    if (pdf <= 0.0f) {
+    /* f and pdf of the selected lobe only, Arnold combines the lobes itself.
+       m is in the local frame, so cosNH is m.z */
+    if (!evalLobes(data, LobeMask(sel_i), m.z, cosNI, out_lobes)) {
+        MLS_COUNT_REJECTED();
         return AI_BSDF_LOBE_MASK_NONE;
     }
 
     // return output direction vectors, we don't compute differentials here
     out_wi = AtVectorDv(wi);
+    out_lobe_index = sel_i;
 
-    // specify that we sampled the first (and only) lobe
-    out_lobe_index = 0;
+    // the weight accounts for picking this lobe among the others
+    out_lobes[sel_i].weight /= sel_prob;
 
-    // return weight and pdf
-    out_lobes[out_lobe_index] = AtBSDFLobeSample(f / pdf, 0, pdf);
-    
-    // indicate that we have valid lobe samples for all the requested lobes,
-    // which is just one lobe in this case
-    return lobe_mask & LobeMask(out_lobe_index);
+    return LobeMask(sel_i);
 }
 
 bsdf_eval
 {
     LayerStackBSDF* data = (LayerStackBSDF*)AiBSDFGetData(bsdf);
 
+    const AtBSDFLobeMask mask = lobe_mask & validLobes(data);
+    if (mask == AI_BSDF_LOBE_MASK_NONE)
+        return AI_BSDF_LOBE_MASK_NONE;
+
     // discard rays below the hemisphere
     const float cosNI = AiV3Dot(data->N, wi);
-    const float cosNO = AiV3Dot(data->N, data->wo);
-    if (cosNI <= 0.f || cosNO <= 0.f)
+    if (cosNI <= 0.f)
        return AI_BSDF_LOBE_MASK_NONE;
 
     // half
     AtVector H = AiV3Normalize(data->wo + wi);
 
-    // result
-    AtRGB f(0.0f, 0.0f, 0.0f);
-    float pdf = 0.0;
-    float cum_w = 0.0;
-
-    // compute coeffs and alphas using adding-doubling
-    AtRGB coeffs[10];
-    float alphas[10];
-    int nb_valid = 0;
-    computeAddingDoubling(cosNO, fmin(data->albedos.size(), 10), data->albedos, data->etas, data->kappas, data->alphas, data->depths, data->sigma_a, data->sigma_s,
-        coeffs, alphas, nb_valid);
-
-    if (nb_valid == 0) {
-        return AI_BSDF_LOBE_MASK_NONE;
-    }
-
-    /* Sum the contribution of all the interfaces */
-    for (int i = 0; i < nb_valid; ++i) {
-
-        // Skip zero contributions
-        if (AiColorIsSmall(coeffs[i])) {
-            continue;
-        }
-
-        // Fetch current roughness
-        const float a = alphas[i];
-
-        // Evaluate microfacet model
-        const float D = distributionGGX(AiV3Dot(data->N, H), a);
-        const float G = geometrySmith(cosNI, cosNO, a);
-        const float G1 = smithShlickGGX(cosNI, a);
-
-        AtRGB f_this = D * G * coeffs[i] / (4.0f * cosNO);
-        float DG1 = D * G1 / (4.0f * cosNO);
-        if (DG1 < 1e-6f || isnan(DG1) || isInvalid(f_this) || average(f_this) > 1e8f) {
-            continue;
-        }
-
-        // Add to the contribution
-        f += f_this;
-
-        // pdf
-        float weight = average(coeffs[i]);
-        cum_w += weight;
-        pdf += weight * DG1;
-    }
-
-    if (cum_w > 0.0f && pdf > 1e-6f) {
-        pdf /= cum_w;
-    }
-    else {
-        return AI_BSDF_LOBE_MASK_NONE;
-    }
-    
-    // return weight and pdf, same as in bsdf_sample
-    int lobe_index = 0;
-    out_lobes[lobe_index] = AtBSDFLobeSample(f / pdf, 0, pdf);
-    
-    return lobe_mask & LobeMask(lobe_index);
+    /* Weight and pdf of each requested interface */
+    return evalLobes(data, mask, AiV3Dot(data->N, H), cosNI, out_lobes);
 }
 
 AtBSDF* LayerStackBSDFCreate(const AtShaderGlobals* sg, const LayerStackBSDF& lsbsdf)
 {
     AtBSDF* bsdf = AiBSDF(sg, AI_RGB_WHITE, LayerStackBSDFMtd, sizeof(LayerStackBSDF));
     LayerStackBSDF* data = (LayerStackBSDF*)AiBSDFGetData(bsdf);
-    new(data) LayerStackBSDF();
-    *data = lsbsdf;
+    memcpy(data, &lsbsdf, sizeof(LayerStackBSDF));
     return bsdf;
 }
\ No newline at end of file
@@ -1,71 +1,134 @@
 #pragma once
 #include "util.h"
+#include <cstdint>
+#include <type_traits>
 
+// Maximum number of interfaces in a stack. The BSDF data is sized for it at
+// compile time, so raising it grows every closure.
+#ifndef MLS_MAX_LAYERS
+#define MLS_MAX_LAYERS 10
+#endif
+
+// Plugin release, part of the keys of everything cached from its output
+#define MLS_PLUGIN_VERSION "1.1.0"
+
+// Every interface is its own Arnold lobe, and lobe masks are 32 bits
+static_assert(MLS_MAX_LAYERS <= 32, "one BSDF lobe per layer interface");
+
+// Counts bsdf_sample calls and the samples it rejects, reported when the
+// layerstack nodes finish. Off by default, the counters are shared atomics.
+#ifndef MLS_ENABLE_SAMPLE_STATS
+#define MLS_ENABLE_SAMPLE_STATS 0
+#endif
+
+struct AngularTable;
+
+// Closure data, copied as-is into the AiBSDF data block. Layers are stored as
+// fixed-capacity arrays so the struct stays trivially copyable: no heap
+// allocations per closure and nothing to destruct when Arnold frees it.
 struct LayerStackBSDF
 {
-    std::vector<AtRGB> albedos;
-    std::vector<float> etas;
-    std::vector<float> kappas;
-    std::vector<float> alphas;
-    std::vector<float> depths;
-    std::vector<AtRGB> sigma_a;
-    std::vector<AtRGB> sigma_s;
+    AtRGB albedos[MLS_MAX_LAYERS];
+    float etas[MLS_MAX_LAYERS + 1];   // etas[0] / kappas[0] is the outside medium
+    float kappas[MLS_MAX_LAYERS + 1];
+    float alphas[MLS_MAX_LAYERS];
+    float depths[MLS_MAX_LAYERS];
+    AtRGB sigma_a[MLS_MAX_LAYERS];
+    AtRGB sigma_s[MLS_MAX_LAYERS];
+    int nb_layers;
+
+    // optional precomputed adding-doubling output, owned by the shader node
+    const AngularTable* table;
 
     // geometry, don't need to set at creating bsdf
     /* parameters */
     AtVector N, wo;
     /* set in bsdf_init */
     AtVector Ng, Ns;
+    AtVector U, V;
+    float cosNO;
+
+    /* adding-doubling output, only depends on wo so it's computed once in bsdf_init */
+    AtRGB coeffs[MLS_MAX_LAYERS];
+    float lobe_alphas[MLS_MAX_LAYERS];
+    float sel_prob[MLS_MAX_LAYERS];     // probability of sampling each lobe
+    float cdf[MLS_MAX_LAYERS];          // lobe selection distribution, cdf[nb_valid - 1] == 1
+    float pdf_scale[MLS_MAX_LAYERS];    // G1(wo) / (4 cos_o), the pdf of lobe i is pdf_scale[i] * D
+    float cum_w;
+    int nb_valid;
 
-    LayerStackBSDF() : 
-        albedos(0), etas(0), kappas(0), alphas(0), depths(0), sigma_a(0), sigma_s(0), 
-        N(), wo(), Ng(), Ns() 
-    {
-        etas.push_back(1.0f);
-        kappas.push_back(0.0f);
+    LayerStackBSDF() { reset(); }
+
+    void reset() {
+        nb_layers = 0;
+        etas[0] = 1.0f;
+        kappas[0] = 0.0f;
+        table = nullptr;
+        cosNO = 0.0f;
+        cum_w = 0.0f;
+        nb_valid = 0;
     }
 
-    LayerStackBSDF(const LayerStackBSDF& b) :
-        albedos(b.albedos), etas(b.etas), kappas(b.kappas), alphas(b.kappas), 
-        depths(b.depths), sigma_a(b.sigma_a), sigma_s(b.sigma_s), 
-        N(b.N), wo(b.wo), Ng(b.Ng), Ns(b.Ns)
-    {}
-
-    LayerStackBSDF& operator=(const LayerStackBSDF& b) {
-        albedos.clear();
-        albedos.assign(b.albedos.begin(), b.albedos.end());
-        etas.clear();
-        etas.assign(b.etas.begin(), b.etas.end());
-        kappas.clear();
-        kappas.assign(b.kappas.begin(), b.kappas.end());
-        alphas.clear();
-        alphas.assign(b.alphas.begin(), b.alphas.end());
-        depths.clear();
-        depths.assign(b.depths.begin(), b.depths.end());
-        sigma_a.clear();
-        sigma_a.assign(b.sigma_a.begin(), b.sigma_a.end());
-        sigma_s.clear();
-        sigma_s.assign(b.sigma_s.begin(), b.sigma_s.end());
-        N = b.N;
-        wo = b.wo;
-        Ng = b.Ng;
-        Ns = b.Ns;
-        return *this;
+    // Appends a layer below the current ones, returns false once the stack is full.
+    bool addLayer(const AtRGB& albedo, float eta, float kappa, float alpha, float depth, const AtRGB& sa, const AtRGB& ss) {
+        if (nb_layers >= MLS_MAX_LAYERS)
+            return false;
+        albedos[nb_layers] = albedo;
+        etas[nb_layers + 1] = eta;
+        kappas[nb_layers + 1] = kappa;
+        alphas[nb_layers] = alpha;
+        depths[nb_layers] = depth;
+        sigma_a[nb_layers] = sa;
+        sigma_s[nb_layers] = ss;
+        nb_layers++;
+        return true;
     }
+
+    // IOR of the bottom-most layer, volumes inherit it
+    float lastEta() const { return etas[nb_layers]; }
 };
 
+static_assert(std::is_trivially_copyable<LayerStackBSDF>::value, "LayerStackBSDF is memcpy'd into the AiBSDF data block");
+
 AtBSDF* LayerStackBSDFCreate(const AtShaderGlobals* sg, const LayerStackBSDF& lsbsdf);
 
+#if MLS_ENABLE_SAMPLE_STATS
+struct SampleStats {
+    uint64_t samples;
+    uint64_t rejected;  // wi below the hemisphere or zero pdf
+};
+
+// Returns the counts since the last call and resets them
+SampleStats takeSampleStats();
+#endif
+
 void computeAddingDoubling(
     float cosNI, const int nb_layers,
-    const std::vector<AtRGB>& m_albedos,
-    const std::vector<float>& m_etas,
-    const std::vector<float>& m_kappas,
-    const std::vector<float>& m_alphas,
-    const std::vector<float>& m_depths,
-    const std::vector<AtRGB>& m_sigma_a,
-    const std::vector<AtRGB>& m_sigma_s,
+    const AtRGB* m_albedos,
+    const float* m_etas,
+    const float* m_kappas,
+    const float* m_alphas,
+    const float* m_depths,
+    const AtRGB* m_sigma_a,
+    const AtRGB* m_sigma_s,
     AtRGB* coeffs,
     float* alphas,
     int& nb_valid);
 
+// Hash of what computeAddingDoubling depends on besides its arguments: the
+// plugin version, MLS_MAX_LAYERS and the contents of the TIR and Ess tables
+uint64_t addingDoublingDataHash();
+
+// Same recursion one channel at a time, kept as the reference for the SIMD path
+void computeAddingDoublingScalar(
+    float cosNI, const int nb_layers,
+    const AtRGB* m_albedos,
+    const float* m_etas,
+    const float* m_kappas,
+    const float* m_alphas,
+    const float* m_depths,
+    const AtRGB* m_sigma_a,
+    const AtRGB* m_sigma_s,
+    AtRGB* coeffs,
+    float* alphas,
+    int& nb_valid);
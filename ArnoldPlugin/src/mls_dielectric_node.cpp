@@ -1,7 +1,6 @@
 #include <ai.h>
-#include <sstream>
-#include <string>
-#include <iomanip>
+#include "layer_record.h"
+#include "layer_graph.h"
 
 AI_SHADER_NODE_EXPORT_METHODS(MLSDielectricNodeMtd);
 
@@ -18,29 +17,38 @@ node_parameters
 
 node_initialize
 {
+    AiNodeSetLocalData(node, new LayerLeafData);
 }
 
 node_update
 {
+    // Without linked inputs the layer is the same for every sample
+    LayerLeafData* data = (LayerLeafData*)AiNodeGetLocalData(node);
+    LayerRecord layer;
+    const bool constant = foldLayerNode(node, layer);
+    setFolded(data->folded, constant, constant ? layer.toString().c_str() : "");
+    registerLayerOutput(node, data->output);
 }
 
 node_finish
 {
+    LayerLeafData* data = (LayerLeafData*)AiNodeGetLocalData(node);
+    unregisterLayerOutput(data->output);
+    delete data;
+    AiNodeSetLocalData(node, nullptr);
 }
 
 shader_evaluate
 {
-    float eta = AiShaderEvalParamFlt(p_eta);
-    float alpha = AiShaderEvalParamFlt(p_alpha);
+    LayerLeafData* data = (LayerLeafData*)AiNodeGetLocalData(node);
+    if (data->folded.constant) {
+        sg->out.STR() = data->folded.value;
+        return;
+    }
 
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(3);
-    ss << "{eta=" << eta << ";";
-    ss << "alpha=" << alpha << "}";
+    LayerRecord layer;
+    layer.eta = AiShaderEvalParamFlt(p_eta);
+    layer.alpha = AiShaderEvalParamFlt(p_alpha);
 
-    std::string outstd = ss.str();
-
-    AtString out(outstd.c_str());
-
-    sg->out.STR() = out;
+    data->output.emit(sg)->append(layer);
 }
@@ -1,7 +1,6 @@
 #include <ai.h>
-#include <sstream>
-#include <string>
-#include <iomanip>
+#include "layer_record.h"
+#include "layer_graph.h"
 
 AI_SHADER_NODE_EXPORT_METHODS(MLSMetalNodeMtd);
 
@@ -22,33 +21,40 @@ node_parameters
 
 node_initialize
 {
+    AiNodeSetLocalData(node, new LayerLeafData);
 }
 
 node_update
 {
+    // Without linked inputs the layer is the same for every sample
+    LayerLeafData* data = (LayerLeafData*)AiNodeGetLocalData(node);
+    LayerRecord layer;
+    const bool constant = foldLayerNode(node, layer);
+    setFolded(data->folded, constant, constant ? layer.toString().c_str() : "");
+    registerLayerOutput(node, data->output);
 }
 
 node_finish
 {
+    LayerLeafData* data = (LayerLeafData*)AiNodeGetLocalData(node);
+    unregisterLayerOutput(data->output);
+    delete data;
+    AiNodeSetLocalData(node, nullptr);
 }
 
 shader_evaluate
 {
-    AtRGB albedo = AiShaderEvalParamRGB(p_albedo);
-    float eta = AiShaderEvalParamFlt(p_eta);
-    float kappa = AiShaderEvalParamFlt(p_kappa);
-    float alpha = AiShaderEvalParamFlt(p_alpha);
-
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(3);
-    ss << "{albedo=" << albedo.r << "," << albedo.g << "," << albedo.b << ";";
-    ss << "eta=" << eta << ";";
-    ss << "kappa=" << kappa << ";";
-    ss << "alpha=" << alpha << "}";
-
-    std::string outstd = ss.str();
-
-    AtString out(outstd.c_str());
-
-    sg->out.STR() = out;
+    LayerLeafData* data = (LayerLeafData*)AiNodeGetLocalData(node);
+    if (data->folded.constant) {
+        sg->out.STR() = data->folded.value;
+        return;
+    }
+
+    LayerRecord layer;
+    layer.albedo = AiShaderEvalParamRGB(p_albedo);
+    layer.eta = AiShaderEvalParamFlt(p_eta);
+    layer.kappa = AiShaderEvalParamFlt(p_kappa);
+    layer.alpha = AiShaderEvalParamFlt(p_alpha);
+
+    data->output.emit(sg)->append(layer);
 }
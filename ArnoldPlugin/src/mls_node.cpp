@@ -3,52 +3,22 @@
 #include <string>
 #include <sstream>
 #include "mls_bsdf.h"
+#include "layer_parser.h"
+#include "layer_graph.h"
+#include "angular_table.h"
+#include "stack_cache.h"
 
 AI_SHADER_NODE_EXPORT_METHODS(MLSNodeMtd);
 
-struct MaterialParam {
-    std::string key;
-    std::vector<float> values;
+// Per-node state. When `param` is not linked, or linked to a constant graph of
+// layerstack_* nodes, the stack is built once in node_update and copied at shade time.
+// The angular table is optional and only built for compiled stacks.
+struct LayerStackNodeData {
+    LayerStackBSDF stack;
+    AngularTable table;
+    bool compiled = false;
 };
 
-std::vector<std::string> split(const std::string& str, const std::string& delimiter) {
-    std::vector<std::string> parts;
-    size_t start = 0;
-    size_t end = str.find(delimiter);
-    while (end != std::string::npos) {
-        parts.push_back(str.substr(start, end - start));
-        start = end + delimiter.length();
-        end = str.find(delimiter, start);
-    }
-    parts.push_back(str.substr(start));  // ʣһ
-    return parts;
-}
-
-MaterialParam parse_param(const std::string& param_str) {
-    MaterialParam param;
-
-    size_t sep = param_str.find('=');
-    if (sep == std::string::npos)
-        return param; // սṹ巵
-
-    param.key = param_str.substr(0, sep);
-    std::string value_str = param_str.substr(sep + 1);
-
-    if (param.key == "albedo") {
-        // value  "0.3,0.4,0.5"
-        std::vector<std::string> comps = split(value_str, ",");
-        for (const std::string& s : comps) {
-            param.values.push_back(std::stof(s));
-        }
-    }
-    else {
-        // ֻһ float
-        param.values.push_back(std::stof(value_str));
-    }
-
-    return param;
-}
-
 enum LayerStackParams {
     /*p_albedo_0,
     p_eta_0,
@@ -60,7 +30,15 @@ enum LayerStackParams {
     p_eta_1,
     p_kappa_1,
     p_alpha_1*/
-    p_param
+    p_param,
+    p_angular_table,
+    p_angular_table_tolerance,
+    p_layer_albedo,
+    p_layer_eta,
+    p_layer_kappa,
+    p_layer_roughness,
+    p_layer_depth,
+    p_layer_g
 };
 
 node_parameters
@@ -76,126 +54,116 @@ node_parameters
     AiParameterFlt("kappa_1", 2.9f);
     AiParameterFlt("alpha_1", 0.2f);*/
     AiParameterStr("param", "");
+    AiParameterBool("angular_table", false);
+    AiParameterFlt("angular_table_tolerance", 2e-3f);
+
+    // Flattened stack, one element per layer top to bottom. When set, it
+    // replaces `param`: volumetric layers have a depth > 0, the others are
+    // metals or dielectrics (kappa 0)
+    AiParameterArray("layer_albedo", AiArrayAllocate(0, 1, AI_TYPE_RGB));
+    AiParameterArray("layer_eta", AiArrayAllocate(0, 1, AI_TYPE_FLOAT));
+    AiParameterArray("layer_kappa", AiArrayAllocate(0, 1, AI_TYPE_FLOAT));
+    AiParameterArray("layer_roughness", AiArrayAllocate(0, 1, AI_TYPE_FLOAT));
+    AiParameterArray("layer_depth", AiArrayAllocate(0, 1, AI_TYPE_FLOAT));
+    AiParameterArray("layer_g", AiArrayAllocate(0, 1, AI_TYPE_FLOAT));
 }
 
 node_initialize
 {
-    LayerStackBSDF * bsdf = new LayerStackBSDF;
-    AiNodeSetLocalData(node, bsdf);
+    LayerStackNodeData* data = new LayerStackNodeData;
+    AiNodeSetLocalData(node, data);
 }
 
 node_update
 {
+    LayerStackNodeData* data = (LayerStackNodeData*)AiNodeGetLocalData(node);
+
+    // Layer arrays are read directly. Otherwise a param linked to a graph of
+    // layerstack_* nodes without varying inputs is folded into a constant
+    // stack here, anything else is evaluated per sample (the fallback in
+    // shader_evaluate).
+    data->stack.reset();
+    std::string records;
+    const int nb_array_layers = readLayerArrays(node, records);
+    data->compiled = nb_array_layers > 0 || foldLayerInput(node, "param", records);
+    if (data->compiled) {
+        if (nb_array_layers == 0 && AiNodeIsLinked(node, "param")) {
+            AiMsgDebug("[layerstack] %s: constant layer graph folded at update", AiNodeGetName(node));
+        }
+        if (!parse_layer_stack(records.c_str(), data->stack)) {
+            AiMsgWarning("[layerstack] %s: more than %d layers, the bottom ones are ignored",
+                AiNodeGetName(node), MLS_MAX_LAYERS);
+        }
+    }
+
+    // Tabulate adding-doubling over cosNO so bsdf_init only interpolates.
+    // Setting MLS_CACHE_DIR turns the tables on for every compiled stack:
+    // they are what's cached, later renders map them instead of building.
+    data->table.reset();
+    const bool use_cache = stackCacheEnabled();
+    if (data->compiled && (use_cache || AiNodeGetBool(node, AtString("angular_table")))) {
+        const float tolerance = AiNodeGetFlt(node, AtString("angular_table_tolerance"));
+        const uint64_t key = use_cache ? stackCacheKey(records, tolerance) : 0;
+        float mean_error = 0.0f, max_error = 0.0f;
+        if (use_cache && loadCachedTable(key, records, tolerance, data->table)) {
+            data->stack.table = &data->table;
+            AiMsgDebug("[layerstack] %s: angular table with %d entries mapped from the cache",
+                AiNodeGetName(node), data->table.resolution);
+        }
+        else if (data->table.build(data->stack, tolerance, mean_error, max_error)) {
+            data->stack.table = &data->table;
+            AiMsgInfo("[layerstack] %s: angular table with %d entries, mean error %g, max error %g",
+                AiNodeGetName(node), data->table.resolution, mean_error, max_error);
+            if (use_cache)
+                storeCachedTable(key, records, tolerance, data->table);
+        }
+        else {
+            AiMsgWarning("[layerstack] %s: angular table can't reach tolerance %g (mean error %g), using direct evaluation",
+                AiNodeGetName(node), tolerance, mean_error);
+        }
+    }
 }
 
 node_finish
 {
+    LayerStackNodeData* data = (LayerStackNodeData*)AiNodeGetLocalData(node);
+    delete data;
+    AiNodeSetLocalData(node, nullptr);
+
+    // like the sample stats below, the first node to finish reports the render
+    const StackCacheStats cache_stats = takeStackCacheStats();
+    if (cache_stats.hits + cache_stats.misses > 0) {
+        AiMsgInfo("[layerstack] angular table cache: %llu hits, %llu misses",
+            (unsigned long long)cache_stats.hits, (unsigned long long)cache_stats.misses);
+    }
+
+#if MLS_ENABLE_SAMPLE_STATS
+    // counters are global, the first node to finish reports the whole render
+    const SampleStats stats = takeSampleStats();
+    if (stats.samples > 0) {
+        AiMsgInfo("[layerstack] %llu BSDF samples, %llu rejected (%.2f%%)",
+            (unsigned long long)stats.samples, (unsigned long long)stats.rejected,
+            100.0 * stats.rejected / stats.samples);
+    }
+#endif
 }
 
 shader_evaluate
 {
     if (sg->Rt & AI_RAY_SHADOW)
         return;
-    /*AtRGB albedo_0 = AiShaderEvalParamRGB(p_albedo_0);
-    float eta_0 = AiShaderEvalParamFlt(p_eta_0);
-    float kappa_0 = AiShaderEvalParamFlt(p_kappa_0);
-    float alpha_0 = AiShaderEvalParamFlt(p_alpha_0);
-    AtRGB albedo_m = AiShaderEvalParamRGB(p_albedo_m);
-    float depth_m = AiShaderEvalParamFlt(p_depth_m);
-    AtRGB albedo_1 = AiShaderEvalParamRGB(p_albedo_1);
-    float eta_1 = AiShaderEvalParamFlt(p_eta_1);
-    float kappa_1 = AiShaderEvalParamFlt(p_kappa_1);
-    float alpha_1 = AiShaderEvalParamFlt(p_alpha_1);*/
-    
-    AtString params = AiShaderEvalParamStr(p_param);
-    std::string paramstr(params.c_str());
 
-    LayerStackBSDF lsbsdf;
-    /*lsbsdf.albedos.push_back(albedo_0);
-    lsbsdf.etas.push_back(eta_0);
-    lsbsdf.kappas.push_back(kappa_0);
-    lsbsdf.alphas.push_back(alpha_0);
-    lsbsdf.depths.push_back(0);
-    lsbsdf.sigma_a.push_back(AtRGB(0));
-    lsbsdf.sigma_s.push_back(AtRGB(0));
-
-    lsbsdf.albedos.push_back(albedo_m);
-    lsbsdf.etas.push_back(1.0f);
-    lsbsdf.kappas.push_back(0);
-    lsbsdf.alphas.push_back(0);
-    lsbsdf.depths.push_back(depth_m);
-    AtRGB sigma_a, sigma_s;
-    computeSigma(albedo_m, 0.1, sigma_a, sigma_s);
-    lsbsdf.sigma_a.push_back(sigma_a);
-    lsbsdf.sigma_s.push_back(sigma_s);
-
-    lsbsdf.albedos.push_back(albedo_1);
-    lsbsdf.etas.push_back(eta_1);
-    lsbsdf.kappas.push_back(kappa_1);
-    lsbsdf.alphas.push_back(alpha_1);
-    lsbsdf.depths.push_back(0);
-    lsbsdf.sigma_a.push_back(AtRGB(0));
-    lsbsdf.sigma_s.push_back(AtRGB(0));*/
-
-    // 1ȥβ `{`  `}`
-    if (!paramstr.empty() && paramstr.front() == '{') paramstr.erase(0, 1);
-    if (!paramstr.empty() && paramstr.back() == '}') paramstr.pop_back();
-
-    // 2 "}{" ָ
-    std::vector<std::string> layers = split(paramstr, "}{");
-
-    // 3ÿٰ `;` ָ
-    //std::ofstream outFile("E:/CIS6600_/SIG_TOOL/plugin/output.txt", std::ios::app);
-    for (const std::string& layer : layers) {
-        std::vector<std::string> params_layer = split(layer, ";");
-        AtRGB albedo(1.0);
-        float eta = 1.0;
-        float kappa = 0.0;
-        float alpha = 0.0;
-        float depth = 0.0;
-        float g = 0.0;
-        AtRGB sigma_a(0.0);
-        AtRGB sigma_s(0.0);
-        
-        for (const std::string& p : params_layer) {
-            MaterialParam mp = parse_param(p);
-            if (mp.key == "albedo") {
-                albedo.r = mp.values[0];
-                albedo.g = mp.values[1];
-                albedo.b = mp.values[2];
-            }
-            else if (mp.key == "eta") {
-                eta = mp.values[0];
-            }
-            else if (mp.key == "kappa") {
-                kappa = mp.values[0];
-            }
-            else if (mp.key == "alpha") {
-                alpha = mp.values[0];
-            }
-            else if (mp.key == "depth") {
-                depth = mp.values[0];
-            }
-            else if (mp.key == "g") {
-                g = mp.values[0];
-            }
-        }
-        if (depth > 0.0) {
-            computeSigma(albedo, 1.0, sigma_a, sigma_s);
-            alpha = gToVariance(g);
-            eta = lsbsdf.etas.back();
-        }
-        
-        lsbsdf.albedos.push_back(albedo);
-        lsbsdf.etas.push_back(eta);
-        lsbsdf.kappas.push_back(kappa);
-        lsbsdf.alphas.push_back(alpha);
-        lsbsdf.depths.push_back(depth);
-        lsbsdf.sigma_a.push_back(sigma_a);
-        lsbsdf.sigma_s.push_back(sigma_s);
+    const LayerStackNodeData* data = (const LayerStackNodeData*)AiNodeGetLocalData(node);
+    if (data->compiled) {
+        sg->out.CLOSURE() = LayerStackBSDFCreate(sg, data->stack);
+        return;
     }
 
-    //outFile.close();
+    LayerRecordList layers;
+    appendLayers(AiShaderEvalParamStr(p_param), sg, layers);
+
+    LayerStackBSDF lsbsdf;
+    add_layers(layers, lsbsdf);
 
     sg->out.CLOSURE() = LayerStackBSDFCreate(sg, lsbsdf);
-}
\ No newline at end of file
+}
@@ -1,6 +0,0 @@
-#include <ai.h>
-#include <random>
-
-float rand1();
-AtVector2 rand2();
-AtVector rand3();
\ No newline at end of file
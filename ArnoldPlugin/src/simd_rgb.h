@@ -0,0 +1,79 @@
+#pragma once
+#include "util.h"
+
+// SSE2 is part of x86-64, define MLS_NO_SIMD to force the scalar path
+#if !defined(MLS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define MLS_USE_SSE 1
+#include <emmintrin.h>
+#else
+#define MLS_USE_SSE 0
+#endif
+
+// Helpers shared by AtRGB and RGB4 so the adding-doubling kernel can be
+// instantiated for both. The AtRGB versions are the scalar reference.
+inline AtRGB rgbExp(const AtRGB& c) {
+    return AiRGBExp(c);
+}
+
+inline AtRGB rgbClamp(const AtRGB& c, float lo, float hi) {
+    return AiRGBClamp(c, lo, hi);
+}
+
+inline AtRGB toAtRGB(const AtRGB& c) {
+    return c;
+}
+
+#if MLS_USE_SSE
+
+// RGB triple packed in one SSE register, the 4th lane is padding. Every energy
+// term of the recursion becomes one vector op instead of three scalar ones.
+struct RGB4
+{
+    __m128 v;
+
+    RGB4() = default;
+    explicit RGB4(__m128 x) : v(x) {}
+    explicit RGB4(float s) : v(_mm_set1_ps(s)) {}
+    explicit RGB4(const AtRGB& c) : v(_mm_setr_ps(c.r, c.g, c.b, 0.0f)) {}
+
+    RGB4 operator+(const RGB4& o) const { return RGB4(_mm_add_ps(v, o.v)); }
+    RGB4 operator-(const RGB4& o) const { return RGB4(_mm_sub_ps(v, o.v)); }
+    RGB4 operator*(const RGB4& o) const { return RGB4(_mm_mul_ps(v, o.v)); }
+    RGB4 operator/(const RGB4& o) const { return RGB4(_mm_div_ps(v, o.v)); }
+    RGB4 operator*(float s) const { return RGB4(_mm_mul_ps(v, _mm_set1_ps(s))); }
+    RGB4 operator/(float s) const { return RGB4(_mm_div_ps(v, _mm_set1_ps(s))); }
+    RGB4& operator+=(const RGB4& o) { v = _mm_add_ps(v, o.v); return *this; }
+    RGB4& operator*=(const RGB4& o) { v = _mm_mul_ps(v, o.v); return *this; }
+    RGB4& operator*=(float s) { v = _mm_mul_ps(v, _mm_set1_ps(s)); return *this; }
+};
+
+inline RGB4 operator*(float s, const RGB4& c) {
+    return c * s;
+}
+
+inline float average(const RGB4& c) {
+    // r + g + b in lane 0, the padding lane is ignored
+    __m128 t = _mm_add_ss(c.v, _mm_shuffle_ps(c.v, c.v, _MM_SHUFFLE(1, 1, 1, 1)));
+    t = _mm_add_ss(t, _mm_movehl_ps(c.v, c.v));
+    return 0.333333333333333f * _mm_cvtss_f32(t);
+}
+
+inline AtRGB toAtRGB(const RGB4& c) {
+    alignas(16) float f[4];
+    _mm_store_ps(f, c.v);
+    return AtRGB(f[0], f[1], f[2]);
+}
+
+inline RGB4 rgbExp(const RGB4& c) {
+    return RGB4(AiRGBExp(toAtRGB(c)));
+}
+
+inline RGB4 rgbClamp(const RGB4& c, float lo, float hi) {
+    return RGB4(_mm_min_ps(_mm_max_ps(c.v, _mm_set1_ps(lo)), _mm_set1_ps(hi)));
+}
+
+#else
+
+typedef AtRGB RGB4;
+
+#endif
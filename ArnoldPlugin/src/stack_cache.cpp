@@ -0,0 +1,181 @@
+#include "stack_cache.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MAGIC[4] = { 'M', 'L', 'S', 'T' };
+
+// Layout of the files, what they hold is versioned by the key
+const uint32_t FORMAT_VERSION = 1;
+
+// File layout: header, records (padded to 4 bytes),
+// AtRGB coeffs[resolution][MLS_MAX_LAYERS], float alphas[resolution][MLS_MAX_LAYERS]
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t max_layers;
+    int32_t resolution;
+    int32_t nb_valid;
+    float tolerance;
+    uint64_t key;
+    uint32_t records_size;
+    uint32_t reserved;
+    uint64_t checksum;  // FNV-1a of everything after the header
+};
+
+static_assert(sizeof(AtRGB) == 3 * sizeof(float), "AtRGB is stored as 3 floats");
+
+std::atomic<uint64_t> s_hits(0);
+std::atomic<uint64_t> s_misses(0);
+std::atomic<uint32_t> s_writes(0);
+
+const std::filesystem::path& cacheDirectory() {
+    static const std::filesystem::path dir = [] {
+        const char* env = getenv("MLS_CACHE_DIR");
+        return std::filesystem::path(env ? env : "");
+    }();
+    return dir;
+}
+
+std::filesystem::path cachePath(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.mlst", (unsigned long long)key);
+    return cacheDirectory() / name;
+}
+
+size_t paddedSize(size_t size) {
+    return (size + 3) & ~size_t(3);
+}
+
+size_t tableBytes(int resolution) {
+    return size_t(resolution) * MLS_MAX_LAYERS * (sizeof(AtRGB) + sizeof(float));
+}
+
+}
+
+bool stackCacheEnabled() {
+    return !cacheDirectory().empty();
+}
+
+uint64_t stackCacheKey(const std::string& records, float tolerance) {
+    const uint64_t data_hash = addingDoublingDataHash();
+
+    uint64_t hash = fnv1a64(records.data(), records.size());
+    hash = fnv1a64(&tolerance, sizeof(tolerance), hash);
+    return fnv1a64(&data_hash, sizeof(data_hash), hash);
+}
+
+bool loadCachedTable(uint64_t key, const std::string& records, float tolerance, AngularTable& table) {
+    std::unique_ptr<MappedFile> file(new MappedFile);
+    if (!file->open(cachePath(key).string())) {
+        s_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    CacheHeader header;
+    bool valid = file->size() >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file->data(), sizeof(header));
+        valid = memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+            && header.version == FORMAT_VERSION
+            && header.max_layers == MLS_MAX_LAYERS
+            && header.key == key
+            && header.tolerance == tolerance
+            && header.resolution >= AngularTable::MIN_RESOLUTION
+            && header.resolution <= AngularTable::MAX_RESOLUTION
+            && header.nb_valid >= 0 && header.nb_valid <= MLS_MAX_LAYERS
+            && header.records_size == records.size()
+            && file->size() == sizeof(header) + paddedSize(records.size()) + tableBytes(header.resolution);
+    }
+    // guards against hash collisions and corrupted files
+    valid = valid && memcmp(file->data() + sizeof(header), records.data(), records.size()) == 0
+        && fnv1a64(file->data() + sizeof(header), file->size() - sizeof(header)) == header.checksum;
+    if (!valid) {
+        AiMsgWarning("[layerstack] ignoring stale cache file %s", cachePath(key).string().c_str());
+        s_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const unsigned char* tables = file->data() + sizeof(header) + paddedSize(records.size());
+    const AtRGB* coeffs = reinterpret_cast<const AtRGB*>(tables);
+    const float* alphas = reinterpret_cast<const float*>(tables + size_t(header.resolution) * MLS_MAX_LAYERS * sizeof(AtRGB));
+    table.attach(std::move(file), coeffs, alphas, header.resolution, header.nb_valid);
+    s_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void storeCachedTable(uint64_t key, const std::string& records, float tolerance, const AngularTable& table) {
+    if (table.empty())
+        return;
+
+    CacheHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.max_layers = MLS_MAX_LAYERS;
+    header.resolution = table.resolution;
+    header.nb_valid = table.nb_valid;
+    header.tolerance = tolerance;
+    header.key = key;
+    header.records_size = (uint32_t)records.size();
+    header.reserved = 0;
+
+    const char padding[4] = { 0, 0, 0, 0 };
+    const size_t padding_size = paddedSize(records.size()) - records.size();
+    const size_t count = size_t(table.resolution) * MLS_MAX_LAYERS;
+    header.checksum = fnv1a64(records.data(), records.size());
+    header.checksum = fnv1a64(padding, padding_size, header.checksum);
+    header.checksum = fnv1a64(table.coeff_data, count * sizeof(AtRGB), header.checksum);
+    header.checksum = fnv1a64(table.alpha_data, count * sizeof(float), header.checksum);
+
+    const std::filesystem::path path = cachePath(key);
+    // node_updates run in parallel and processes share the directory, so the
+    // temporary name is unique to the process, the thread and the write
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".tmp%d-%zx-%u", (int)getpid(),
+        std::hash<std::thread::id>()(std::this_thread::get_id()), s_writes.fetch_add(1));
+    std::filesystem::path tmp = path;
+    tmp += suffix;
+
+    std::error_code ec;
+    std::filesystem::create_directories(cacheDirectory(), ec);
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(records.data(), records.size());
+        out.write(padding, padding_size);
+        out.write(reinterpret_cast<const char*>(table.coeff_data), count * sizeof(AtRGB));
+        out.write(reinterpret_cast<const char*>(table.alpha_data), count * sizeof(float));
+        if (!out) {
+            AiMsgWarning("[layerstack] couldn't write cache file %s", tmp.string().c_str());
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+
+    // another process may have written the same table meanwhile, either copy is fine
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        std::filesystem::remove(tmp, ec);
+}
+
+StackCacheStats takeStackCacheStats() {
+    StackCacheStats stats;
+    stats.hits = s_hits.exchange(0);
+    stats.misses = s_misses.exchange(0);
+    return stats;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "angular_table.h"
+#include <cstdint>
+#include <string>
+
+// Angular tables cached on disk across renders, one file per stack in the
+// directory named by the MLS_CACHE_DIR environment variable (disabled when it
+// isn't set). Files are keyed by a hash of the exact layer records, the table
+// tolerance, the plugin version and the TIR and Ess tables, and memory-mapped
+// on a hit. A shared directory works across farm nodes: files are written
+// under a name unique to the writer and renamed into place. Setting the
+// variable gives every compiled stack a table, angular_table or not.
+
+struct StackCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+};
+
+bool stackCacheEnabled();
+
+uint64_t stackCacheKey(const std::string& records, float tolerance);
+
+// Maps the cached table for key into table. Returns false on a miss, including
+// when the file is stale, truncated or belongs to different records.
+bool loadCachedTable(uint64_t key, const std::string& records, float tolerance, AngularTable& table);
+
+// Writes a built table, failures only produce a warning
+void storeCachedTable(uint64_t key, const std::string& records, float tolerance, const AngularTable& table);
+
+// Returns the counts since the last call and resets them
+StackCacheStats takeStackCacheStats();
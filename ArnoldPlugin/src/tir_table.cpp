@@ -0,0 +1,88 @@
+#include "tir_table.h"
+#include <cstring>
+
+namespace {
+
+// Loads the shipped table, falling back to the working directory like before
+struct DefaultTIRTable : TIRTable {
+    DefaultTIRTable() {
+        const std::filesystem::path path = getPluginDirectory() / "TIR.bin";
+        if (!load(path.string()) && !load("TIR.bin")) {
+            AiMsgWarning("[layerstack] couldn't load %s, TIR is ignored", path.string().c_str());
+        }
+    }
+};
+
+}
+
+const TIRTable& TIRTable::get() {
+    static const DefaultTIRTable table;
+    return table;
+}
+
+bool TIRTable::load(const std::string& path) {
+    m_data = nullptr;
+    m_hash = 0;
+    m_sanitized.clear();
+    if (!m_file.open(path))
+        return false;
+
+    if (m_file.size() < HEADER_SIZE) {
+        AiMsgWarning("[layerstack] %s: truncated header", path.c_str());
+        m_file.close();
+        return false;
+    }
+
+    int sizes[3];
+    float range[6];
+    memcpy(sizes, m_file.data(), sizeof(sizes));
+    memcpy(range, m_file.data() + sizeof(sizes), sizeof(range));
+
+    // Validate the header dimensions against the file size
+    const size_t max_dim = 4096;
+    size_t count = 1;
+    for (int k = 0; k < 3; ++k) {
+        if (sizes[k] <= 0 || (size_t)sizes[k] > max_dim || !(range[2 * k + 1] > range[2 * k])) {
+            AiMsgWarning("[layerstack] %s: invalid header", path.c_str());
+            m_file.close();
+            return false;
+        }
+        count *= sizes[k];
+    }
+    if (m_file.size() != HEADER_SIZE + count * sizeof(float)) {
+        AiMsgWarning("[layerstack] %s: expected %zu bytes for a %dx%dx%d table, got %zu",
+            path.c_str(), HEADER_SIZE + count * sizeof(float), sizes[0], sizes[1], sizes[2], m_file.size());
+        m_file.close();
+        return false;
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        m_size[k] = sizes[k];
+        m_min[k] = range[2 * k];
+        m_scale[k] = sizes[k] / (range[2 * k + 1] - range[2 * k]);
+    }
+    m_stride[0] = sizes[1] * sizes[2];
+    m_stride[1] = sizes[2];
+    m_stride[2] = 1;
+
+    m_hash = fnv1a64(m_file.data(), m_file.size());
+
+    // NaN cells contribute nothing to the interpolation. Zero them once here,
+    // in a private copy, so the fetch doesn't need to test every corner.
+    const float* values = reinterpret_cast<const float*>(m_file.data() + HEADER_SIZE);
+    for (size_t i = 0; i < count; ++i) {
+        if (std::isnan(values[i])) {
+            m_sanitized.assign(values, values + count);
+            for (float& v : m_sanitized) {
+                if (std::isnan(v))
+                    v = 0.0f;
+            }
+            m_file.close();
+            m_data = m_sanitized.data();
+            return true;
+        }
+    }
+
+    m_data = values;
+    return true;
+}
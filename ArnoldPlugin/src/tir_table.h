@@ -0,0 +1,60 @@
+#pragma once
+#include "util.h"
+#include "file_utils.h"
+
+// Total internal reflection term over (cos theta, roughness, relative IOR).
+// TIR.bin layout: int Nt, Na, Nn; float tm, tM, am, aM, nm, nM; float data[Nt][Na][Nn]
+class TIRTable
+{
+public:
+    static const size_t HEADER_SIZE = 3 * sizeof(int) + 6 * sizeof(float);
+
+    // Process-wide table, mapped from TIR.bin next to the plugin on first use
+    static const TIRTable& get();
+
+    bool load(const std::string& path);
+    bool ok() const { return m_data != nullptr; }
+
+    // FNV-1a of the loaded file, 0 when nothing is loaded. Results cached
+    // across renders depend on it.
+    uint64_t contentHash() const { return m_hash; }
+
+    // Trilinear fetch: 8 loads, no per-corner branches. Indices are clamped to
+    // the grid and the upper corner collapses onto the lower one at the border.
+    inline float operator() (float t, float a, float n) const {
+        const float x[3] = {
+            (t - m_min[0]) * m_scale[0],
+            (a - m_min[1]) * m_scale[1],
+            (n - m_min[2]) * m_scale[2]
+        };
+
+        int base = 0;
+        int d[3];
+        float w[3];
+        for (int k = 0; k < 3; ++k) {
+            const int i = _clamp<int>((int)floorf(x[k]), 0, m_size[k] - 1);
+            w[k] = _clamp<float>(x[k] - i, 0.0f, 1.0f);
+            d[k] = (i + 1 < m_size[k]) ? m_stride[k] : 0;
+            base += i * m_stride[k];
+        }
+
+        const float* p = m_data + base;
+        const float c00 = p[0] + w[2] * (p[d[2]] - p[0]);
+        const float c01 = p[d[1]] + w[2] * (p[d[1] + d[2]] - p[d[1]]);
+        const float c10 = p[d[0]] + w[2] * (p[d[0] + d[2]] - p[d[0]]);
+        const float c11 = p[d[0] + d[1]] + w[2] * (p[d[0] + d[1] + d[2]] - p[d[0] + d[1]]);
+        const float c0 = c00 + w[1] * (c01 - c00);
+        const float c1 = c10 + w[1] * (c11 - c10);
+        return c0 + w[0] * (c1 - c0);
+    }
+
+private:
+    MappedFile m_file;
+    std::vector<float> m_sanitized; // only used when the file contains NaNs
+    const float* m_data = nullptr;
+    uint64_t m_hash = 0;
+    int m_size[3] = { 0, 0, 0 };
+    int m_stride[3] = { 0, 0, 0 };
+    float m_min[3] = { 0.0f, 0.0f, 0.0f };
+    float m_scale[3] = { 0.0f, 0.0f, 0.0f };
+};
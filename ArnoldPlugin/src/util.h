@@ -4,6 +4,7 @@
 #include <ai_shader_bsdf.h>
 #include <ai_shaderglobals.h>
 #include <cmath>
+#include <cstdint>
 #include <vector>
 
 #define USE_BEST_FIT
@@ -17,6 +18,16 @@ inline T sqr(T x) {
     return x * x;
 }
 
+// 64-bit FNV-1a. Chain calls by passing the previous hash as the seed.
+inline uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 inline bool isInvalid(AtRGB c) {
 	return (c.r < 0 || c.g < 0 || c.b < 0 || isnan(c.r) || isnan(c.g) || isnan(c.b));
 }
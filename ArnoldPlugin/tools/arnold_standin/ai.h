@@ -0,0 +1,132 @@
+#pragma once
+// Minimal stand-in for the Arnold SDK headers, covering only the types and
+// functions the BSDF sources use. It lets the tools build and run on machines
+// without an Arnold license; it is never used by the plugin itself.
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <math.h>
+
+#define AI_PI 3.14159265358979323846f
+
+struct AtVector
+{
+    float x, y, z;
+
+    AtVector() = default;
+    constexpr AtVector(float x, float y, float z) : x(x), y(y), z(z) {}
+
+    AtVector operator+(const AtVector& o) const { return AtVector(x + o.x, y + o.y, z + o.z); }
+    AtVector operator-(const AtVector& o) const { return AtVector(x - o.x, y - o.y, z - o.z); }
+    AtVector operator*(const AtVector& o) const { return AtVector(x * o.x, y * o.y, z * o.z); }
+    AtVector operator*(float s) const { return AtVector(x * s, y * s, z * s); }
+    AtVector operator/(float s) const { return AtVector(x / s, y / s, z / s); }
+    AtVector operator-() const { return AtVector(-x, -y, -z); }
+    AtVector& operator+=(const AtVector& o) { x += o.x; y += o.y; z += o.z; return *this; }
+    bool operator==(const AtVector& o) const { return x == o.x && y == o.y && z == o.z; }
+    bool operator!=(const AtVector& o) const { return !(*this == o); }
+};
+inline AtVector operator*(float s, const AtVector& v) { return v * s; }
+
+struct AtVector2
+{
+    float x, y;
+
+    AtVector2() = default;
+    constexpr AtVector2(float x, float y) : x(x), y(y) {}
+    constexpr AtVector2(const AtVector& v) : x(v.x), y(v.y) {}
+
+    AtVector2 operator+(const AtVector2& o) const { return AtVector2(x + o.x, y + o.y); }
+    AtVector2 operator-(const AtVector2& o) const { return AtVector2(x - o.x, y - o.y); }
+    AtVector2 operator*(float s) const { return AtVector2(x * s, y * s); }
+    AtVector2 operator-(float s) const { return AtVector2(x - s, y - s); }
+};
+
+struct AtRGB
+{
+    float r, g, b;
+
+    AtRGB() = default;
+    constexpr explicit AtRGB(float v) : r(v), g(v), b(v) {}
+    constexpr AtRGB(float r, float g, float b) : r(r), g(g), b(b) {}
+
+    AtRGB operator+(const AtRGB& o) const { return AtRGB(r + o.r, g + o.g, b + o.b); }
+    AtRGB operator-(const AtRGB& o) const { return AtRGB(r - o.r, g - o.g, b - o.b); }
+    AtRGB operator*(const AtRGB& o) const { return AtRGB(r * o.r, g * o.g, b * o.b); }
+    AtRGB operator/(const AtRGB& o) const { return AtRGB(r / o.r, g / o.g, b / o.b); }
+    AtRGB operator+(float s) const { return AtRGB(r + s, g + s, b + s); }
+    AtRGB operator-(float s) const { return AtRGB(r - s, g - s, b - s); }
+    AtRGB operator*(float s) const { return AtRGB(r * s, g * s, b * s); }
+    AtRGB operator/(float s) const { return AtRGB(r / s, g / s, b / s); }
+    AtRGB operator-() const { return AtRGB(-r, -g, -b); }
+    AtRGB& operator+=(const AtRGB& o) { r += o.r; g += o.g; b += o.b; return *this; }
+    AtRGB& operator-=(const AtRGB& o) { r -= o.r; g -= o.g; b -= o.b; return *this; }
+    AtRGB& operator*=(const AtRGB& o) { r *= o.r; g *= o.g; b *= o.b; return *this; }
+    AtRGB& operator*=(float s) { r *= s; g *= s; b *= s; return *this; }
+    AtRGB& operator/=(float s) { r /= s; g /= s; b /= s; return *this; }
+    bool operator==(const AtRGB& o) const { return r == o.r && g == o.g && b == o.b; }
+    bool operator!=(const AtRGB& o) const { return !(*this == o); }
+    float& operator[](int i) { return (&r)[i]; }
+    const float& operator[](int i) const { return (&r)[i]; }
+};
+inline AtRGB operator+(float s, const AtRGB& c) { return c + s; }
+inline AtRGB operator-(float s, const AtRGB& c) { return AtRGB(s) - c; }
+inline AtRGB operator*(float s, const AtRGB& c) { return c * s; }
+inline AtRGB operator/(float s, const AtRGB& c) { return AtRGB(s) / c; }
+
+static const AtRGB AI_RGB_BLACK(0.0f, 0.0f, 0.0f);
+static const AtRGB AI_RGB_WHITE(1.0f, 1.0f, 1.0f);
+
+// Returns the process-wide copy of s, like Arnold's string table
+const char* AiStandinInternString(const char* s);
+
+// Arnold interns strings, so the source buffer may go away and equal strings
+// compare by pointer
+class AtString
+{
+public:
+    AtString() = default;
+    explicit AtString(const char* s) : m_str(s ? AiStandinInternString(s) : nullptr) {}
+    const char* c_str() const { return m_str ? m_str : ""; }
+    bool empty() const { return !m_str || !*m_str; }
+    bool operator==(const AtString& o) const { return m_str == o.m_str; }
+
+private:
+    const char* m_str = nullptr;
+};
+
+template<typename T>
+inline T AiClamp(T v, T lo, T hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+inline float AiV2Dot(const AtVector2& a, const AtVector2& b) { return a.x * b.x + a.y * b.y; }
+inline float AiV3Dot(const AtVector& a, const AtVector& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline AtVector AiV3Cross(const AtVector& a, const AtVector& b)
+{
+    return AtVector(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline float AiV3Length(const AtVector& a) { return sqrtf(AiV3Dot(a, a)); }
+inline AtVector AiV3Normalize(const AtVector& a)
+{
+    const float l = AiV3Length(a);
+    return l > 0.0f ? a / l : a;
+}
+void AiV3BuildLocalFrame(AtVector& u, AtVector& v, const AtVector& n);
+
+inline AtRGB AiRGBClamp(const AtRGB& c, float lo, float hi)
+{
+    return AtRGB(AiClamp(c.r, lo, hi), AiClamp(c.g, lo, hi), AiClamp(c.b, lo, hi));
+}
+inline bool AiColorIsSmall(const AtRGB& c, float epsilon = 1e-6f)
+{
+    return fabsf(c.r) < epsilon && fabsf(c.g) < epsilon && fabsf(c.b) < epsilon;
+}
+
+// Messages go to stderr so they don't mix with the benchmark output
+void AiMsgInfo(const char* format, ...);
+void AiMsgWarning(const char* format, ...);
+void AiMsgError(const char* format, ...);
+
+#include "ai_shaderglobals.h"
+#include "ai_shader_bsdf.h"
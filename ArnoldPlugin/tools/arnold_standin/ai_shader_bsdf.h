@@ -0,0 +1,73 @@
+#pragma once
+#include "ai.h"
+
+typedef uint32_t AtBSDFLobeMask;
+#define AI_BSDF_LOBE_MASK_NONE 0u
+
+struct AtBSDF;
+
+struct AtBSDFLobeInfo
+{
+    int ray_type;
+    int flags;
+    AtString label;
+};
+
+struct AtBSDFLobeSample
+{
+    AtBSDFLobeSample() = default;
+    AtBSDFLobeSample(const AtRGB& weight, float reverse_pdf, float pdf)
+        : weight(weight), reverse_pdf(reverse_pdf), pdf(pdf) {}
+
+    AtRGB weight;
+    float reverse_pdf;
+    float pdf;
+};
+
+struct AtVectorDv
+{
+    AtVectorDv() = default;
+    explicit AtVectorDv(const AtVector& v) : val(v), dx(0.0f, 0.0f, 0.0f), dy(0.0f, 0.0f, 0.0f) {}
+
+    AtVector val, dx, dy;
+};
+
+#define bsdf_init \
+static void Init(const AtShaderGlobals* sg, AtBSDF* bsdf)
+
+#define bsdf_sample \
+static AtBSDFLobeMask Sample(const AtBSDF* bsdf, const AtVector rnd, const float wavelength, \
+    const AtBSDFLobeMask lobe_mask, const bool need_pdf, AtVectorDv& out_wi, int& out_lobe_index, \
+    AtBSDFLobeSample out_lobes[], AtRGB& k_r, AtRGB& k_t)
+
+#define bsdf_eval \
+static AtBSDFLobeMask Eval(const AtBSDF* bsdf, const AtVector& wi, const AtBSDFLobeMask lobe_mask, \
+    const bool need_pdf, AtBSDFLobeSample out_lobes[], AtRGB& k_r, AtRGB& k_t)
+
+// Unlike Arnold the method table is public, the renderer is whoever holds it
+struct AtBSDFMethods
+{
+    void (*Init)(const AtShaderGlobals* sg, AtBSDF* bsdf);
+    AtBSDFLobeMask (*Sample)(const AtBSDF* bsdf, const AtVector rnd, const float wavelength,
+        const AtBSDFLobeMask lobe_mask, const bool need_pdf, AtVectorDv& out_wi, int& out_lobe_index,
+        AtBSDFLobeSample out_lobes[], AtRGB& k_r, AtRGB& k_t);
+    AtBSDFLobeMask (*Eval)(const AtBSDF* bsdf, const AtVector& wi, const AtBSDFLobeMask lobe_mask,
+        const bool need_pdf, AtBSDFLobeSample out_lobes[], AtRGB& k_r, AtRGB& k_t);
+};
+
+#define AI_BSDF_EXPORT_METHODS(tbl) \
+bsdf_init; \
+bsdf_sample; \
+bsdf_eval; \
+static const AtBSDFMethods tbl##_impl = { Init, Sample, Eval }; \
+const AtBSDFMethods* tbl = &tbl##_impl
+
+AtBSDF* AiBSDF(const AtShaderGlobals* sg, const AtRGB& weight, const AtBSDFMethods* methods, size_t data_size);
+void* AiBSDFGetData(const AtBSDF* bsdf);
+void AiBSDFInitLobes(AtBSDF* bsdf, const AtBSDFLobeInfo* lobes, int num_lobes);
+void AiBSDFInitNormal(AtBSDF* bsdf, const AtVector& N, bool bounding);
+
+// Stand-in only: what the renderer would otherwise do with a closure
+const AtBSDFMethods* AiStandinBSDFMethods(const AtBSDF* bsdf);
+const AtBSDFLobeInfo* AiStandinBSDFLobes(const AtBSDF* bsdf, int& num_lobes);
+void AiStandinBSDFDestroy(AtBSDF* bsdf);
@@ -0,0 +1,16 @@
+#pragma once
+#include "ai.h"
+
+#define AI_RAY_DIFFUSE_REFLECT  0x04
+#define AI_RAY_SPECULAR_REFLECT 0x08
+#define AI_RAY_SHADOW           0x100
+
+// Only the members read by bsdf_init
+struct AtShaderGlobals
+{
+    AtVector P;
+    AtVector N, Nf, Ng, Ngf, Ns;
+    AtVector Rd;
+    int Rt;
+    int tid;
+};
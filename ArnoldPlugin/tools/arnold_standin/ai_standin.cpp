@@ -0,0 +1,112 @@
+#include "ai.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+struct AtBSDF
+{
+    const AtBSDFMethods* methods;
+    const AtBSDFLobeInfo* lobes;
+    int num_lobes;
+    AtVector N;
+    AtRGB weight;
+    void* data;
+};
+
+const char* AiStandinInternString(const char* s)
+{
+    // node-based set: element addresses are stable across rehashes
+    static std::mutex lock;
+    static std::unordered_set<std::string> strings;
+    std::lock_guard<std::mutex> guard(lock);
+    return strings.insert(s).first->c_str();
+}
+
+void AiV3BuildLocalFrame(AtVector& u, AtVector& v, const AtVector& n)
+{
+    // Duff et al. 2017, continuous and branch-free apart from the sign
+    const float sign = copysignf(1.0f, n.z);
+    const float a = -1.0f / (sign + n.z);
+    const float b = n.x * n.y * a;
+    u = AtVector(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    v = AtVector(b, sign + n.y * n.y * a, -n.y);
+}
+
+static void message(const char* severity, const char* format, va_list args)
+{
+    fprintf(stderr, "%s", severity);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+}
+
+void AiMsgInfo(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    message("", format, args);
+    va_end(args);
+}
+
+void AiMsgWarning(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    message("WARNING | ", format, args);
+    va_end(args);
+}
+
+void AiMsgError(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    message("ERROR | ", format, args);
+    va_end(args);
+}
+
+AtBSDF* AiBSDF(const AtShaderGlobals*, const AtRGB& weight, const AtBSDFMethods* methods, size_t data_size)
+{
+    AtBSDF* bsdf = new AtBSDF();
+    bsdf->methods = methods;
+    bsdf->lobes = nullptr;
+    bsdf->num_lobes = 0;
+    bsdf->N = AtVector(0.0f, 0.0f, 1.0f);
+    bsdf->weight = weight;
+    bsdf->data = calloc(1, data_size);
+    return bsdf;
+}
+
+void* AiBSDFGetData(const AtBSDF* bsdf)
+{
+    return bsdf->data;
+}
+
+void AiBSDFInitLobes(AtBSDF* bsdf, const AtBSDFLobeInfo* lobes, int num_lobes)
+{
+    bsdf->lobes = lobes;
+    bsdf->num_lobes = num_lobes;
+}
+
+void AiBSDFInitNormal(AtBSDF* bsdf, const AtVector& N, bool)
+{
+    bsdf->N = N;
+}
+
+const AtBSDFMethods* AiStandinBSDFMethods(const AtBSDF* bsdf)
+{
+    return bsdf->methods;
+}
+
+const AtBSDFLobeInfo* AiStandinBSDFLobes(const AtBSDF* bsdf, int& num_lobes)
+{
+    num_lobes = bsdf->num_lobes;
+    return bsdf->lobes;
+}
+
+void AiStandinBSDFDestroy(AtBSDF* bsdf)
+{
+    free(bsdf->data);
+    delete bsdf;
+}
@@ -0,0 +1,613 @@
+// Microbenchmarks for the BSDF hot paths, run over every preset shipped with the
+// Maya plugin. Results are printed as JSON lines, one object per measurement:
+//   {"benchmark":"bsdf_eval","preset":"RoughSilver","calls":...,"ns_per_call":...,"calls_per_s":...}
+// Builds against the stand-in headers in tools/arnold_standin, which also play
+// the renderer's part of creating and initializing the closures.
+#include "mls_bsdf.h"
+#include "layer_parser.h"
+#include "preset_library.h"
+#include "fresnel.h"
+#include "tir_table.h"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#ifndef MLS_PRESETS_DIR
+#define MLS_PRESETS_DIR "presets"
+#endif
+
+using json = nlohmann::json;
+
+// Heap allocations made through operator new, read by checkClosureMemory
+static std::atomic<int64_t> g_allocations(0);
+static std::atomic<int64_t> g_live_allocations(0);
+
+// Every replaceable form goes through these two. countedFree stays out of
+// line: inlined into a delete of the standard library, GCC pairs its free()
+// with the builtin operator new and warns (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+#define MLS_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define MLS_NOINLINE __declspec(noinline)
+#else
+#define MLS_NOINLINE
+#endif
+
+static void* countedAlloc(size_t size) noexcept
+{
+    void* p = malloc(size ? size : 1);
+    if (p) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_live_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return p;
+}
+
+MLS_NOINLINE static void countedFree(void* p) noexcept
+{
+    if (!p)
+        return;
+    g_live_allocations.fetch_sub(1, std::memory_order_relaxed);
+    free(p);
+}
+
+void* operator new(size_t size)
+{
+    void* p = countedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = countedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { countedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { countedFree(p); }
+
+namespace {
+
+struct Options
+{
+    std::string presets_dir = MLS_PRESETS_DIR;
+    std::string filter;
+    double min_time = 0.2;
+    int variance_samples = 16;
+    int variance_trials = 4096;
+    int memory_closures = 50000;
+};
+
+// Keeps results alive so the timed loops aren't optimized away
+volatile float g_sink;
+
+// ---------------------------------------------------------------------------
+// Harness
+// ---------------------------------------------------------------------------
+
+// Calls batch() until min_time has elapsed, batch returns the calls it made
+template<typename Batch>
+void timeIt(const Options& opt, const char* benchmark, const std::string& preset, Batch batch)
+{
+    batch(); // warm up
+
+    using clock = std::chrono::steady_clock;
+    uint64_t calls = 0;
+    const clock::time_point start = clock::now();
+    double elapsed = 0.0;
+    do {
+        calls += batch();
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < opt.min_time);
+
+    json line;
+    line["benchmark"] = benchmark;
+    line["preset"] = preset;
+    line["calls"] = calls;
+    line["ns_per_call"] = elapsed * 1e9 / calls;
+    line["calls_per_s"] = calls / elapsed;
+    printf("%s\n", line.dump().c_str());
+    fflush(stdout);
+}
+
+AtVector direction(float cosTheta, float phi)
+{
+    const float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    return AtVector(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+}
+
+AtShaderGlobals shadingPoint(const AtVector& wo)
+{
+    AtShaderGlobals sg = AtShaderGlobals();
+    const AtVector N(0.0f, 0.0f, 1.0f);
+    sg.N = sg.Nf = sg.Ng = sg.Ngf = sg.Ns = N;
+    sg.Rd = -wo;
+    sg.Rt = AI_RAY_SPECULAR_REFLECT;
+    return sg;
+}
+
+// Closures for a handful of view angles, initialized like Arnold would
+struct Closures
+{
+    std::vector<AtBSDF*> bsdfs;
+
+    Closures(const LayerStackBSDF& stack, int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            const AtShaderGlobals sg = shadingPoint(direction((i + 0.5f) / count, 0.0f));
+            AtBSDF* bsdf = LayerStackBSDFCreate(&sg, stack);
+            AiStandinBSDFMethods(bsdf)->Init(&sg, bsdf);
+            bsdfs.push_back(bsdf);
+        }
+    }
+    ~Closures()
+    {
+        for (AtBSDF* bsdf : bsdfs)
+            AiStandinBSDFDestroy(bsdf);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+void benchAddingDoubling(const Options& opt, const Preset& p)
+{
+    const LayerStackBSDF& s = p.stack;
+    const int count = 256;
+    std::vector<float> cosines(count);
+    for (int i = 0; i < count; ++i)
+        cosines[i] = (i + 0.5f) / count;
+
+    AtRGB coeffs[MLS_MAX_LAYERS];
+    float alphas[MLS_MAX_LAYERS];
+    int nb_valid = 0;
+
+    timeIt(opt, "adding_doubling", p.name, [&]() {
+        for (float cosNO : cosines) {
+            computeAddingDoubling(cosNO, s.nb_layers, s.albedos, s.etas, s.kappas, s.alphas, s.depths, s.sigma_a, s.sigma_s,
+                coeffs, alphas, nb_valid);
+            g_sink = coeffs[0].r;
+        }
+        return (uint64_t)count;
+    });
+
+    timeIt(opt, "adding_doubling_scalar", p.name, [&]() {
+        for (float cosNO : cosines) {
+            computeAddingDoublingScalar(cosNO, s.nb_layers, s.albedos, s.etas, s.kappas, s.alphas, s.depths, s.sigma_a, s.sigma_s,
+                coeffs, alphas, nb_valid);
+            g_sink = coeffs[0].r;
+        }
+        return (uint64_t)count;
+    });
+
+    // The SIMD path must agree with the scalar reference
+    float max_rel = 0.0f;
+    for (float cosNO : cosines) {
+        AtRGB ref[MLS_MAX_LAYERS];
+        float ref_alphas[MLS_MAX_LAYERS];
+        int ref_valid = 0;
+        computeAddingDoubling(cosNO, s.nb_layers, s.albedos, s.etas, s.kappas, s.alphas, s.depths, s.sigma_a, s.sigma_s,
+            coeffs, alphas, nb_valid);
+        computeAddingDoublingScalar(cosNO, s.nb_layers, s.albedos, s.etas, s.kappas, s.alphas, s.depths, s.sigma_a, s.sigma_s,
+            ref, ref_alphas, ref_valid);
+        for (int i = 0; i < std::min(nb_valid, ref_valid); ++i) {
+            for (int c = 0; c < 3; ++c)
+                max_rel = std::max(max_rel, fabsf(coeffs[i][c] - ref[i][c]) / std::max(fabsf(ref[i][c]), 1e-6f));
+        }
+        if (nb_valid != ref_valid)
+            max_rel = INFINITY;
+    }
+
+    json line;
+    line["benchmark"] = "adding_doubling_simd_vs_scalar";
+    line["preset"] = p.name;
+    line["max_rel_diff"] = max_rel;
+    printf("%s\n", line.dump().c_str());
+}
+
+// What a linked layerstack costs per shading point before the BSDF: the leaf
+// nodes format their layers, the add nodes concatenate and the root parses.
+// "text" is the former {key=value} handoff, "records" the layer_record.h one.
+void benchLayerHandoff(const Options& opt, const Preset& p)
+{
+    std::vector<LayerRecord> layers;
+    for (size_t i = 0; i + LayerRecord::SIZE <= p.layers.size(); i += LayerRecord::SIZE) {
+        LayerRecord layer;
+        if (layer.decode(p.layers.c_str() + i))
+            layers.push_back(layer);
+    }
+
+    timeIt(opt, "layer_handoff_text", p.name, [&]() {
+        std::string stack;
+        for (const LayerRecord& layer : layers) {
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(3);
+            ss << "{albedo=" << layer.albedo.r << "," << layer.albedo.g << "," << layer.albedo.b << ";";
+            ss << "eta=" << layer.eta << ";" << "kappa=" << layer.kappa << ";" << "alpha=" << layer.alpha << ";";
+            ss << "depth=" << layer.depth << ";" << "g=" << layer.g << "}";
+            stack += AtString(ss.str().c_str()).c_str();
+        }
+        LayerStackBSDF s;
+        parse_layer_stack(AtString(stack.c_str()).c_str(), s);
+        g_sink = s.etas[1];
+        return (uint64_t)1;
+    });
+
+    timeIt(opt, "layer_handoff_records", p.name, [&]() {
+        char stack[(MLS_MAX_LAYERS + 1) * LayerRecord::SIZE + 1] = "";
+        size_t len = 0;
+        for (const LayerRecord& layer : layers) {
+            const AtString record = layer.toString();
+            strcpy(stack + len, record.c_str());
+            len += LayerRecord::SIZE;
+        }
+        LayerStackBSDF s;
+        parse_layer_stack(AtString(stack).c_str(), s);
+        g_sink = s.etas[1];
+        return (uint64_t)1;
+    });
+}
+
+void benchInit(const Options& opt, const Preset& p)
+{
+    const int count = 64;
+    std::vector<AtShaderGlobals> sgs;
+    for (int i = 0; i < count; ++i)
+        sgs.push_back(shadingPoint(direction((i + 0.5f) / count, 0.3f * i)));
+
+    AtBSDF* bsdf = LayerStackBSDFCreate(&sgs[0], p.stack);
+    const AtBSDFMethods* methods = AiStandinBSDFMethods(bsdf);
+    LayerStackBSDF* data = (LayerStackBSDF*)AiBSDFGetData(bsdf);
+
+    timeIt(opt, "bsdf_init", p.name, [&]() {
+        for (const AtShaderGlobals& sg : sgs) {
+            methods->Init(&sg, bsdf);
+            g_sink = data->cum_w;
+        }
+        return (uint64_t)count;
+    });
+
+    AiStandinBSDFDestroy(bsdf);
+}
+
+void benchSampleEval(const Options& opt, const Preset& p)
+{
+    const Closures closures(p.stack, 8);
+    const AtBSDFMethods* methods = AiStandinBSDFMethods(closures.bsdfs[0]);
+
+    const int count = 1024;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<AtVector> rnds(count), wis(count);
+    for (int i = 0; i < count; ++i) {
+        rnds[i] = AtVector(uniform(rng), uniform(rng), uniform(rng));
+        wis[i] = direction(sqrtf(uniform(rng)), 2.0f * AI_PI * uniform(rng));
+    }
+
+    timeIt(opt, "bsdf_sample", p.name, [&]() {
+        AtVectorDv wi;
+        int lobe = 0;
+        AtBSDFLobeSample lobes[MLS_MAX_LAYERS];
+        AtRGB k_r, k_t;
+        for (int i = 0; i < count; ++i) {
+            const AtBSDF* bsdf = closures.bsdfs[i & 7];
+            methods->Sample(bsdf, rnds[i], 0.0f, ~0u, true, wi, lobe, lobes, k_r, k_t);
+            g_sink = wi.val.z;
+        }
+        return (uint64_t)count;
+    });
+
+    // Samples bsdf_sample gives up on (wi below the surface or a zero pdf)
+    {
+        AtVectorDv wi;
+        int lobe = 0;
+        AtBSDFLobeSample lobes[MLS_MAX_LAYERS];
+        AtRGB k_r, k_t;
+        int rejected = 0;
+        for (int i = 0; i < count; ++i) {
+            if (!methods->Sample(closures.bsdfs[i & 7], rnds[i], 0.0f, ~0u, true, wi, lobe, lobes, k_r, k_t))
+                ++rejected;
+        }
+
+        json line;
+        line["benchmark"] = "sample_rejection";
+        line["preset"] = p.name;
+        line["samples"] = count;
+        line["rejected_fraction"] = rejected / double(count);
+        printf("%s\n", line.dump().c_str());
+    }
+
+    timeIt(opt, "bsdf_eval", p.name, [&]() {
+        AtBSDFLobeSample lobes[MLS_MAX_LAYERS];
+        AtRGB k_r, k_t;
+        for (int i = 0; i < count; ++i) {
+            const AtBSDF* bsdf = closures.bsdfs[i & 7];
+            const AtBSDFLobeMask mask = methods->Eval(bsdf, wis[i], ~0u, true, lobes, k_r, k_t);
+            for (int l = 0; l < MLS_MAX_LAYERS; ++l) {
+                if (mask & LobeMask(l))
+                    g_sink = lobes[l].pdf;
+            }
+        }
+        return (uint64_t)count;
+    });
+}
+
+// Variance of a directional albedo estimate at a fixed sample count, with the
+// lobe picked from a stratified rnd.z (what Arnold provides) or from an
+// independent random number per sample (the old rand1() behaviour).
+void benchLobeSelectionVariance(const Options& opt, const Preset& p)
+{
+    const AtShaderGlobals sg = shadingPoint(direction(0.5f, 0.0f));
+    AtBSDF* bsdf = LayerStackBSDFCreate(&sg, p.stack);
+    const AtBSDFMethods* methods = AiStandinBSDFMethods(bsdf);
+    methods->Init(&sg, bsdf);
+
+    const int n = opt.variance_samples;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<int> strata(n);
+
+    auto estimate = [&](bool stratified) {
+        for (int i = 0; i < n; ++i)
+            strata[i] = i;
+        std::shuffle(strata.begin(), strata.end(), rng);
+
+        double sum = 0.0;
+        for (int i = 0; i < n; ++i) {
+            const float z = stratified ? (strata[i] + uniform(rng)) / n : uniform(rng);
+            const AtVector rnd(uniform(rng), uniform(rng), std::min(z, 0.99999994f));
+
+            AtVectorDv wi;
+            int lobe = 0;
+            AtBSDFLobeSample lobes[MLS_MAX_LAYERS];
+            AtRGB k_r, k_t;
+            if (methods->Sample(bsdf, rnd, 0.0f, ~0u, true, wi, lobe, lobes, k_r, k_t))
+                sum += average(lobes[lobe].weight);
+        }
+        return sum / n;
+    };
+
+    json line;
+    line["benchmark"] = "lobe_selection_variance";
+    line["preset"] = p.name;
+    line["samples"] = n;
+    line["trials"] = opt.variance_trials;
+    for (int stratified = 0; stratified < 2; ++stratified) {
+        double mean = 0.0, mean2 = 0.0;
+        for (int t = 0; t < opt.variance_trials; ++t) {
+            const double e = estimate(stratified != 0);
+            mean += e;
+            mean2 += e * e;
+        }
+        mean /= opt.variance_trials;
+        mean2 /= opt.variance_trials;
+        const char* key = stratified ? "stratified" : "independent";
+        line[key]["mean"] = mean;
+        line[key]["variance"] = std::max(0.0, mean2 - mean * mean);
+    }
+    printf("%s\n", line.dump().c_str());
+
+    AiStandinBSDFDestroy(bsdf);
+}
+
+// Resident set size in kB, -1 where it can't be read
+long residentKB()
+{
+#ifdef __linux__
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return -1;
+    long pages = 0, resident = 0;
+    const int read = fscanf(f, "%ld %ld", &pages, &resident);
+    fclose(f);
+    return read == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+#else
+    return -1;
+#endif
+}
+
+// Creates, initializes, samples and destroys closures of every preset, the
+// way a render hands them out per shading point. The closure data must be
+// copied without heap allocations: only the stand-in's own AtBSDF wrapper
+// may allocate, nothing may stay allocated and the RSS must stay flat.
+bool checkClosureMemory(const Options& opt, const std::vector<Preset>& presets)
+{
+    auto round = [&](int closures) {
+        AtBSDFLobeSample lobes[MLS_MAX_LAYERS];
+        AtRGB k_r, k_t;
+        AtVectorDv wi;
+        int lobe = 0;
+        for (int i = 0; i < closures; ++i) {
+            const Preset& p = presets[i % presets.size()];
+            const AtShaderGlobals sg = shadingPoint(direction((i % 64 + 0.5f) / 64, 0.1f * i));
+            AtBSDF* bsdf = LayerStackBSDFCreate(&sg, p.stack);
+            const AtBSDFMethods* methods = AiStandinBSDFMethods(bsdf);
+            methods->Init(&sg, bsdf);
+            methods->Sample(bsdf, AtVector(0.3f, 0.6f, (i % 16 + 0.5f) / 16), 0.0f, ~0u, true, wi, lobe, lobes, k_r, k_t);
+            methods->Eval(bsdf, direction(0.7f, 1.0f), ~0u, true, lobes, k_r, k_t);
+            AiStandinBSDFDestroy(bsdf);
+        }
+    };
+
+    // The first round pays for one-time allocations (interned strings, tables)
+    round((int)presets.size() * 16);
+    const long rss_before = residentKB();
+    const int64_t live_before = g_live_allocations.load();
+    const int64_t allocations_before = g_allocations.load();
+
+    const int closures = opt.memory_closures;
+    round(closures);
+
+    const double allocs_per_closure = double(g_allocations.load() - allocations_before) / closures;
+    const int64_t live_growth = g_live_allocations.load() - live_before;
+    const long rss_after = residentKB();
+    const long rss_growth = (rss_before < 0 || rss_after < 0) ? 0 : rss_after - rss_before;
+    const bool ok = allocs_per_closure <= 1.0 && live_growth == 0 && rss_growth < 1024;
+
+    json line;
+    line["benchmark"] = "closure_memory";
+    line["closures"] = closures;
+    line["presets"] = presets.size();
+    line["allocs_per_closure"] = allocs_per_closure;
+    line["live_allocation_growth"] = live_growth;
+    line["rss_growth_kb"] = rss_after < 0 ? json() : json(rss_growth);
+    line["ok"] = ok;
+    printf("%s\n", line.dump().c_str());
+    if (!ok)
+        fprintf(stderr, "closure_memory: closures allocate or leak memory\n");
+    return ok;
+}
+
+void benchFresnel(const Options& opt)
+{
+    const int count = 4096;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> cosines(count), etas(count), kappas(count);
+    for (int i = 0; i < count; ++i) {
+        cosines[i] = 2.0f * uniform(rng) - 1.0f;
+        etas[i] = 0.2f + 2.8f * uniform(rng);
+        kappas[i] = 5.0f * uniform(rng);
+    }
+
+    timeIt(opt, "fresnel_dielectric", "", [&]() {
+        float acc = 0.0f;
+        for (int i = 0; i < count; ++i)
+            acc += fresnelDielectric(cosines[i], etas[i]);
+        g_sink = acc;
+        return (uint64_t)count;
+    });
+
+    timeIt(opt, "fresnel_conductor", "", [&]() {
+        float acc = 0.0f;
+        for (int i = 0; i < count; ++i)
+            acc += fresnelConductor(fabsf(cosines[i]), etas[i], kappas[i]);
+        g_sink = acc;
+        return (uint64_t)count;
+    });
+}
+
+void benchTIR(const Options& opt)
+{
+    const TIRTable& tir = TIRTable::get();
+    if (!tir.ok()) {
+        fprintf(stderr, "TIR.bin not found next to the executable or in the working directory, skipping tir_lookup\n");
+        return;
+    }
+
+    const int count = 4096;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<AtVector> queries(count);
+    for (int i = 0; i < count; ++i)
+        queries[i] = AtVector(uniform(rng), uniform(rng), 4.0f * uniform(rng));
+
+    timeIt(opt, "tir_lookup", "", [&]() {
+        float acc = 0.0f;
+        for (const AtVector& q : queries)
+            acc += tir(q.x, q.y, q.z);
+        g_sink = acc;
+        return (uint64_t)count;
+    });
+}
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: mls_bench [options]\n"
+        "  --presets <dir>          preset directory (default %s)\n"
+        "  --filter <name>          only run presets whose name contains this\n"
+        "  --min-time <seconds>     minimum time per benchmark (default 0.2)\n"
+        "  --variance-samples <n>   samples per estimate in lobe_selection_variance (default 16)\n"
+        "  --variance-trials <n>    estimates per variance (default 4096)\n"
+        "  --memory-closures <n>    closures created by closure_memory (default 50000)\n",
+        MLS_PRESETS_DIR);
+}
+
+bool parseArgs(int argc, char** argv, Options& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return false;
+        }
+        if (arg == "--presets") {
+            opt.presets_dir = argv[++i];
+        } else if (arg == "--filter") {
+            opt.filter = argv[++i];
+        } else if (arg == "--min-time") {
+            opt.min_time = atof(argv[++i]);
+        } else if (arg == "--variance-samples") {
+            opt.variance_samples = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--variance-trials") {
+            opt.variance_trials = std::max(2, atoi(argv[++i]));
+        } else if (arg == "--memory-closures") {
+            opt.memory_closures = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 1;
+    }
+
+    const std::vector<Preset> presets = preset_library::loadPresets(opt.presets_dir, opt.filter);
+    if (presets.empty()) {
+        fprintf(stderr, "no presets found in %s\n", opt.presets_dir.c_str());
+        return 1;
+    }
+
+    // Fails the run, the other measurements are meaningless if closures leak
+    if (!checkClosureMemory(opt, presets))
+        return 2;
+
+    benchFresnel(opt);
+    benchTIR(opt);
+
+    for (const Preset& p : presets) {
+        fprintf(stderr, "%s: %d layers\n", p.name.c_str(), p.stack.nb_layers);
+        benchAddingDoubling(opt, p);
+        benchLayerHandoff(opt, p);
+        benchInit(opt, p);
+        benchSampleEval(opt, p);
+        benchLobeSelectionVariance(opt, p);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#pragma once
+// Loads the preset library of the Maya plugin into layer stacks, the way the
+// layerstack_* nodes would hand them to the layerstack shader. Shared by the
+// tools that need materials without a Maya or Arnold session.
+#include "mls_bsdf.h"
+#include "layer_parser.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct Preset
+{
+    std::string name;
+    std::string layers;
+    LayerStackBSDF stack;
+};
+
+namespace preset_library {
+
+using json = nlohmann::json;
+
+inline float jsonFloat(const json& params, const char* key, float fallback)
+{
+    return params.contains(key) ? params[key].get<float>() : fallback;
+}
+
+inline AtRGB jsonRGB(const json& params, const char* key, const AtRGB& fallback)
+{
+    if (!params.contains(key) || params[key].size() != 3)
+        return fallback;
+    const json& c = params[key];
+    return AtRGB(c[0].get<float>(), c[1].get<float>(), c[2].get<float>());
+}
+
+// Produces the same layer records the layerstack_* nodes would hand to the
+// layerstack shader, with their default parameter values
+inline bool flattenLayer(const json& graph, const std::string& id, std::string& out, int depth = 0)
+{
+    if (!graph.contains(id) || depth > 64)
+        return false;
+
+    const json& node = graph[id];
+    const std::string type = node.value("type", "");
+    const json params = node.value("params", json::object());
+
+    LayerRecord layer;
+    if (type == "root" || type == "surface") {
+        const json children = node.value("children", json::array());
+        return children.size() == 1 && flattenLayer(graph, children[0].get<std::string>(), out, depth + 1);
+    }
+    else if (type == "add") {
+        return flattenLayer(graph, node.value("top_layer", ""), out, depth + 1)
+            && flattenLayer(graph, node.value("bottom_layer", ""), out, depth + 1);
+    }
+    else if (type == "metal") {
+        layer.albedo = jsonRGB(params, "albedo", AtRGB(1.0f, 0.7f, 0.7f));
+        layer.eta = jsonFloat(params, "IOR", 0.5f);
+        layer.kappa = jsonFloat(params, "kappa", 3.0f);
+        layer.alpha = jsonFloat(params, "roughness", 0.2f);
+    }
+    else if (type == "dielectric") {
+        layer.eta = jsonFloat(params, "IOR", 1.5f);
+        layer.alpha = jsonFloat(params, "roughness", 0.01f);
+    }
+    else if (type == "volumetric") {
+        layer.albedo = jsonRGB(params, "albedo", AtRGB(0.0f, 0.62f, 1.0f));
+        layer.depth = jsonFloat(params, "depth", 0.1f);
+        layer.g = jsonFloat(params, "g", 0.7f);
+    }
+    else {
+        return false;
+    }
+
+    out += layer.toString().c_str();
+    return true;
+}
+
+// Every *.json of dir in name order whose name contains filter. Files that
+// aren't a layer graph, or have too many layers, are reported and skipped.
+inline std::vector<Preset> loadPresets(const std::string& dir, const std::string& filter = "")
+{
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+    if (ec)
+        fprintf(stderr, "couldn't list %s: %s\n", dir.c_str(), ec.message().c_str());
+    std::sort(files.begin(), files.end());
+
+    std::vector<Preset> presets;
+    for (const std::filesystem::path& file : files) {
+        Preset preset;
+        preset.name = file.stem().string();
+        if (!filter.empty() && preset.name.find(filter) == std::string::npos)
+            continue;
+
+        std::ifstream in(file);
+        const json graph = json::parse(in, nullptr, false);
+        if (graph.is_discarded() || !flattenLayer(graph, "root", preset.layers)) {
+            fprintf(stderr, "skipping %s: not a layer graph\n", file.string().c_str());
+            continue;
+        }
+        if (!parse_layer_stack(preset.layers.c_str(), preset.stack)) {
+            fprintf(stderr, "skipping %s: more than %d layers\n", file.string().c_str(), MLS_MAX_LAYERS);
+            continue;
+        }
+        presets.push_back(preset);
+    }
+    return presets;
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a batch of independent jobs on a fixed set of threads. Each worker owns a
+// deque: it pops its own jobs from the back and, once empty, steals from the
+// front of the others, so uneven jobs (e.g. grazing-angle cells) balance out.
+class WorkStealingPool
+{
+public:
+    typedef std::function<void(int worker)> Job;
+
+    explicit WorkStealingPool(int num_threads = 0)
+        : m_numThreads(num_threads > 0 ? num_threads : std::max(1, (int)std::thread::hardware_concurrency()))
+    {
+    }
+
+    int numThreads() const { return m_numThreads; }
+
+    // Blocks until every job has run. Jobs are dealt round-robin to the workers.
+    void run(std::vector<Job>& jobs)
+    {
+        std::vector<Queue> queues(m_numThreads);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            queues[i % m_numThreads].jobs.push_back(&jobs[i]);
+        }
+
+        std::vector<std::thread> threads;
+        for (int w = 1; w < m_numThreads; ++w) {
+            threads.emplace_back([&queues, w] { work(queues, w); });
+        }
+        work(queues, 0);
+
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    // Convenience wrapper running fn(index, worker) for index in [0, count)
+    void parallelFor(int count, const std::function<void(int index, int worker)>& fn)
+    {
+        std::vector<Job> jobs;
+        jobs.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            jobs.push_back([&fn, i](int worker) { fn(i, worker); });
+        }
+        run(jobs);
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Job*> jobs;
+    };
+
+    static Job* pop(Queue& q)
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.jobs.empty())
+            return nullptr;
+        Job* job = q.jobs.back();
+        q.jobs.pop_back();
+        return job;
+    }
+
+    static Job* steal(Queue& q)
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.jobs.empty())
+            return nullptr;
+        Job* job = q.jobs.front();
+        q.jobs.pop_front();
+        return job;
+    }
+
+    // Jobs are all queued before the workers start, so a worker that finds
+    // every queue empty is done.
+    static void work(std::vector<Queue>& queues, int self)
+    {
+        const int n = (int)queues.size();
+        for (;;) {
+            Job* job = pop(queues[self]);
+            for (int k = 1; !job && k < n; ++k) {
+                job = steal(queues[(self + k) % n]);
+            }
+            if (!job)
+                return;
+            (*job)(self);
+        }
+    }
+
+    int m_numThreads;
+};
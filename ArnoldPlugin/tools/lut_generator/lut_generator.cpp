@@ -0,0 +1,349 @@
+// Offline generator for the lookup tables used by the adding-doubling model:
+//  - TIR.bin: Fresnel transmittance averaged over the visible microfacets, over
+//    (cos theta, alpha, relative IOR)
+//  - ess_table.h: GGX directional albedo Ess(cos theta, alpha)
+// Both are Monte Carlo integrated with the microfacet functions of the shader,
+// so they have to be regenerated whenever microfacet.h changes.
+#include "util.h"
+#include "microfacet.h"
+#include "fresnel.h"
+#include "../common/work_stealing_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    std::string tir_path;
+    std::string tir_error_path;
+    std::string ess_path;
+    std::string ess_error_path;
+    int tir_res[3] = { 64, 64, 64 };
+    float ior_max = 4.0f;
+    int ess_res_cos = 32;
+    int ess_res_alpha = 32;
+    int samples = 1 << 16;
+    float target_error = 0.0f;
+    int threads = 0;
+};
+
+// Running mean and standard error of one cell
+struct CellEstimate
+{
+    double sum = 0.0;
+    double sum2 = 0.0;
+    int n = 0;
+
+    void add(double x) { sum += x; sum2 += x * x; ++n; }
+    double mean() const { return n ? sum / n : 0.0; }
+    double stdError() const {
+        if (n < 2)
+            return 0.0;
+        const double m = mean();
+        return sqrt(std::max(0.0, sum2 / n - m * m) / (n - 1));
+    }
+};
+
+// Integrates one cell in batches until the standard error drops under the
+// target, or the sample budget is spent. Each cell owns its seed so the
+// output doesn't depend on the thread count or scheduling.
+template<typename Integrand>
+CellEstimate integrateCell(const Options& opt, uint64_t seed, Integrand f)
+{
+    const int batch = 1024;
+    std::mt19937_64 rng(seed * 0x9E3779B97F4A7C15ull + 1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    CellEstimate cell;
+    while (cell.n < opt.samples) {
+        const int count = std::min(batch, opt.samples - cell.n);
+        for (int s = 0; s < count; ++s) {
+            const float u0 = uniform(rng);
+            const float u1 = uniform(rng);
+            cell.add(f(AtVector2(u0, u1)));
+        }
+        if (opt.target_error > 0.0f && cell.stdError() <= opt.target_error)
+            break;
+    }
+    return cell;
+}
+
+// Outgoing direction in the local frame (normal along +z)
+AtVector localDirection(float cosTheta)
+{
+    const float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    return AtVector(sinTheta, 0.0f, cosTheta);
+}
+
+// Directional albedo of the GGX lobe with F = 1, as evaluated by bsdf_eval:
+// f cos = D G / (4 cos_o). bsdf_sample draws visible normals, whose pdf is
+// D G1(wo) / (4 cos_o), so the estimator is G / G1(wo).
+double essSample(const AtVector& wo, float alpha, AtVector2 u)
+{
+    const AtVector h = sampleGGXVNDF(wo, u, alpha);
+    const AtVector wi = reflect(wo, h);
+    if (wi.z <= 0.0f)
+        return 0.0;
+
+    return geometrySmith(wo.z, wi.z, alpha) / smithG1GGX(wo.z, alpha);
+}
+
+// Fraction of the energy refracted through the interface, averaged over the
+// microfacets visible from wo: 1 - F on each facet, and 0 where the facet
+// totally reflects. n is the transmitted over incident IOR.
+double tirSample(const AtVector& wo, float n, float alpha, AtVector2 u)
+{
+    const AtVector m = sampleGGXVNDF(wo, u, alpha);
+    const float wom = AiV3Dot(wo, m);
+    if (n <= 0.0f || (1.0f - wom * wom) >= n * n)
+        return 0.0;
+
+    return 1.0f - fresnelDielectric(wom, n);
+}
+
+struct ErrorStats
+{
+    double mean = 0.0;
+    double max = 0.0;
+    size_t worst = 0;
+};
+
+ErrorStats summarize(const std::vector<float>& errors)
+{
+    ErrorStats stats;
+    for (size_t i = 0; i < errors.size(); ++i) {
+        stats.mean += errors[i];
+        if (errors[i] > stats.max) {
+            stats.max = errors[i];
+            stats.worst = i;
+        }
+    }
+    if (!errors.empty())
+        stats.mean /= errors.size();
+    return stats;
+}
+
+// Same layout as TIR.bin, the error table can be inspected with the same tools
+bool writeTIR(const std::string& path, const Options& opt, const std::vector<float>& values)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        fprintf(stderr, "couldn't open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    const float range[6] = { 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, opt.ior_max };
+    bool ok = fwrite(opt.tir_res, sizeof(int), 3, f) == 3;
+    ok = ok && fwrite(range, sizeof(float), 6, f) == 6;
+    ok = ok && fwrite(values.data(), sizeof(float), values.size(), f) == values.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+        fprintf(stderr, "failed writing %s\n", path.c_str());
+    return ok;
+}
+
+bool writeEssHeader(const std::string& path, const Options& opt, const std::vector<float>& values)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "couldn't open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    fprintf(f, "#pragma once\n\n");
+    fprintf(f, "// Directional albedo Ess(cos theta, alpha) of the GGX lobe, used by evalFresnel\n");
+    fprintf(f, "// for multiple-scattering energy compensation. Rows are roughness and columns\n");
+    fprintf(f, "// are cos theta, both sampled uniformly over [0, 1] (endpoints included).\n");
+    fprintf(f, "// Generated by mls_lut_generator (%d samples per cell).\n", opt.samples);
+    fprintf(f, "static const int ESS_RES_COS = %d;\n", opt.ess_res_cos);
+    fprintf(f, "static const int ESS_RES_ALPHA = %d;\n\n", opt.ess_res_alpha);
+    fprintf(f, "static const float ESS_TABLE[ESS_RES_ALPHA * ESS_RES_COS] = {\n");
+    for (int a = 0; a < opt.ess_res_alpha; ++a) {
+        fprintf(f, "   ");
+        for (int c = 0; c < opt.ess_res_cos; ++c) {
+            fprintf(f, " %.6ff,", values[a * opt.ess_res_cos + c]);
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "};\n");
+    return fclose(f) == 0;
+}
+
+bool writeEssErrors(const std::string& path, const Options& opt, const std::vector<float>& errors)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "couldn't open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    fprintf(f, "alpha,cos_theta,std_error\n");
+    for (int a = 0; a < opt.ess_res_alpha; ++a) {
+        for (int c = 0; c < opt.ess_res_cos; ++c) {
+            fprintf(f, "%g,%g,%g\n",
+                a / float(opt.ess_res_alpha - 1), c / float(opt.ess_res_cos - 1), errors[a * opt.ess_res_cos + c]);
+        }
+    }
+    return fclose(f) == 0;
+}
+
+// Cell k of the TIR table sits at min + k * (max - min) / N, which is where
+// TIRTable::operator() expects it.
+bool generateTIR(WorkStealingPool& pool, const Options& opt)
+{
+    const int Nt = opt.tir_res[0], Na = opt.tir_res[1], Nn = opt.tir_res[2];
+    std::vector<float> values((size_t)Nt * Na * Nn);
+    std::vector<float> errors(values.size());
+
+    // One job per (cos theta, alpha) row; grazing rows are slower to converge
+    pool.parallelFor(Nt * Na, [&](int row, int) {
+        const int t = row / Na;
+        const int a = row % Na;
+        // cos theta = 0 has no projected area, keep it just above the horizon
+        const AtVector wo = localDirection(std::max(t / float(Nt), 1e-4f));
+        const float alpha = std::max(a / float(Na), 1e-4f);
+
+        for (int k = 0; k < Nn; ++k) {
+            const float n = k * opt.ior_max / Nn;
+            const size_t idx = (size_t)row * Nn + k;
+            const CellEstimate cell = integrateCell(opt, idx, [&](AtVector2 u) { return tirSample(wo, n, alpha, u); });
+            values[idx] = (float)cell.mean();
+            errors[idx] = (float)cell.stdError();
+        }
+    });
+
+    const ErrorStats stats = summarize(errors);
+    const int wt = int(stats.worst / ((size_t)Na * Nn));
+    const int wa = int(stats.worst / Nn % Na);
+    const int wn = int(stats.worst % Nn);
+    printf("TIR %dx%dx%d: mean std error %.3g, max %.3g at cos=%g alpha=%g n=%g\n",
+        Nt, Na, Nn, stats.mean, stats.max, wt / float(Nt), wa / float(Na), wn * opt.ior_max / Nn);
+
+    bool ok = writeTIR(opt.tir_path, opt, values);
+    if (!opt.tir_error_path.empty())
+        ok = writeTIR(opt.tir_error_path, opt, errors) && ok;
+    return ok;
+}
+
+bool generateEss(WorkStealingPool& pool, const Options& opt)
+{
+    const int Nc = opt.ess_res_cos, Na = opt.ess_res_alpha;
+    std::vector<float> values((size_t)Nc * Na);
+    std::vector<float> errors(values.size());
+
+    pool.parallelFor(Nc * Na, [&](int idx, int) {
+        const int a = idx / Nc;
+        const int c = idx % Nc;
+        // Ess divides the compensation term, so stay off the horizon where it vanishes
+        const AtVector wo = localDirection(std::max(c / float(Nc - 1), 0.5f / (Nc - 1)));
+        const float alpha = std::max(a / float(Na - 1), 1e-4f);
+
+        const CellEstimate cell = integrateCell(opt, idx, [&](AtVector2 u) { return essSample(wo, alpha, u); });
+        values[idx] = (float)std::min(cell.mean(), 1.0);
+        errors[idx] = (float)cell.stdError();
+    });
+
+    const ErrorStats stats = summarize(errors);
+    printf("Ess %dx%d: mean std error %.3g, max %.3g at cos=%g alpha=%g\n",
+        Nc, Na, stats.mean, stats.max, (stats.worst % Nc) / float(Nc - 1), (stats.worst / Nc) / float(Na - 1));
+
+    bool ok = writeEssHeader(opt.ess_path, opt, values);
+    if (!opt.ess_error_path.empty())
+        ok = writeEssErrors(opt.ess_error_path, opt, errors) && ok;
+    return ok;
+}
+
+void usage()
+{
+    printf(
+        "usage: mls_lut_generator [options]\n"
+        "  --tir <file>             write the TIR table (TIR.bin format)\n"
+        "  --tir-error <file>       write the per-cell standard error, same format\n"
+        "  --tir-res <t> <a> <n>    TIR resolution (default 64 64 64)\n"
+        "  --ior-max <n>            upper bound of the relative IOR axis (default 4)\n"
+        "  --ess <file>             write the Ess table as a C++ header (ess_table.h)\n"
+        "  --ess-error <file>       write the per-cell standard error as CSV\n"
+        "  --ess-res <cos> <alpha>  Ess resolution (default 32 32)\n"
+        "  --samples <n>            maximum samples per cell (default 65536)\n"
+        "  --target-error <e>       stop a cell once its standard error is below e\n"
+        "  --threads <n>            worker threads (default: all cores)\n");
+}
+
+bool parseArgs(int argc, char** argv, Options& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const int left = argc - i - 1;
+        if (arg == "--tir" && left >= 1) {
+            opt.tir_path = argv[++i];
+        } else if (arg == "--tir-error" && left >= 1) {
+            opt.tir_error_path = argv[++i];
+        } else if (arg == "--tir-res" && left >= 3) {
+            for (int k = 0; k < 3; ++k)
+                opt.tir_res[k] = atoi(argv[++i]);
+        } else if (arg == "--ior-max" && left >= 1) {
+            opt.ior_max = (float)atof(argv[++i]);
+        } else if (arg == "--ess" && left >= 1) {
+            opt.ess_path = argv[++i];
+        } else if (arg == "--ess-error" && left >= 1) {
+            opt.ess_error_path = argv[++i];
+        } else if (arg == "--ess-res" && left >= 2) {
+            opt.ess_res_cos = atoi(argv[++i]);
+            opt.ess_res_alpha = atoi(argv[++i]);
+        } else if (arg == "--samples" && left >= 1) {
+            opt.samples = atoi(argv[++i]);
+        } else if (arg == "--target-error" && left >= 1) {
+            opt.target_error = (float)atof(argv[++i]);
+        } else if (arg == "--threads" && left >= 1) {
+            opt.threads = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "unknown or incomplete option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    // Same bounds TIRTable::load accepts
+    for (int k = 0; k < 3; ++k) {
+        if (opt.tir_res[k] < 2 || opt.tir_res[k] > 4096) {
+            fprintf(stderr, "TIR resolution must be in [2, 4096]\n");
+            return false;
+        }
+    }
+    if (opt.ess_res_cos < 2 || opt.ess_res_alpha < 2 || opt.samples < 2 || !(opt.ior_max > 0.0f)) {
+        fprintf(stderr, "invalid Ess resolution, sample count or IOR range\n");
+        return false;
+    }
+    return !opt.tir_path.empty() || !opt.ess_path.empty();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 1;
+    }
+
+    WorkStealingPool pool(opt.threads);
+    printf("%d threads, up to %d samples per cell\n", pool.numThreads(), opt.samples);
+
+    bool ok = true;
+    const auto start = std::chrono::steady_clock::now();
+    if (!opt.tir_path.empty())
+        ok = generateTIR(pool, opt) && ok;
+    if (!opt.ess_path.empty())
+        ok = generateEss(pool, opt) && ok;
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("done in %.1fs\n", seconds);
+    return ok ? 0 : 1;
+}
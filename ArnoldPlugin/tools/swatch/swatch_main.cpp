@@ -0,0 +1,447 @@
+// Renders a preview swatch for every preset of the Maya plugin: a sphere under
+// a studio environment, shaded on the CPU with the layerstack closure itself
+// (adding-doubling through the angular table, GGX lobes) so no Arnold session
+// or license is needed. Tiles of every swatch to render are spread over all
+// cores by one work-stealing pool.
+//
+// Swatches are cached as <cache>/<hash>.png, the hash covering the layer
+// records and the render settings, so renaming a preset or rerunning on an
+// unchanged library renders nothing. One JSON line is printed per preset:
+//   {"preset":"RoughSilver","hash":"...","swatch":".../<hash>.png","cached":true}
+// followed by a summary line. The Maya UI reads them to show the previews.
+#include "mls_bsdf.h"
+#include "angular_table.h"
+#include "preset_library.h"
+#include "work_stealing_pool.h"
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef MLS_PRESETS_DIR
+#define MLS_PRESETS_DIR "presets"
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+
+// Bump when the scene or the shading changes, so cached swatches are redone
+const uint32_t SWATCH_VERSION = 1;
+
+// Tolerance of the layerstack node's angular table by default
+const float TABLE_TOLERANCE = 2e-3f;
+
+struct Options
+{
+    std::string presets_dir = MLS_PRESETS_DIR;
+    std::string cache_dir = "swatches";
+    std::string filter;
+    int size = 128;
+    int spp = 128;
+    int tile = 16;
+    int threads = 0;
+    bool force = false;
+};
+
+// What the image depends on besides the layers, hashed into the cache key.
+// data_hash covers the plugin version and the TIR and Ess tables, like the
+// keys of the plugin's angular table cache.
+struct RenderSettings
+{
+    uint32_t version;
+    int32_t size;
+    int32_t spp;
+    float table_tolerance;
+    uint64_t data_hash;
+};
+static_assert(sizeof(RenderSettings) == 24, "no padding in the hashed bytes");
+
+struct Swatch
+{
+    const Preset* preset = nullptr;
+    uint64_t hash = 0;
+    std::filesystem::path path;
+    bool cached = false;
+    AngularTable table;
+    std::vector<float> pixels;  // RGBA, linear
+};
+
+struct Tile
+{
+    Swatch* swatch;
+    int x0, y0, x1, y1;
+};
+
+// ---------------------------------------------------------------------------
+// Scene
+// ---------------------------------------------------------------------------
+
+// Camera looking down -z at a unit sphere, y up. Sky gradient, dark ground and
+// a large soft key light above the camera on the left. Everything is smooth so
+// BSDF sampling alone converges, there are no lights to sample.
+AtRGB environment(const AtVector& dir)
+{
+    AtRGB radiance;
+    if (dir.y >= 0.0f) {
+        const float t = sqrtf(dir.y);
+        radiance = AtRGB(0.55f, 0.58f, 0.62f) * (1.0f - t) + AtRGB(0.25f, 0.32f, 0.45f) * t;
+    }
+    else {
+        radiance = AtRGB(0.12f, 0.11f, 0.10f);
+    }
+
+    static const AtVector key = AiV3Normalize(AtVector(-0.6f, 0.7f, 0.6f));
+    const float k = expf(24.0f * (AiV3Dot(dir, key) - 1.0f));
+    return radiance + AtRGB(4.0f, 3.9f, 3.7f) * k;
+}
+
+// Small per-pixel hash driving the sample sequence, so images are the same
+// whatever the tiling and the thread count
+struct PixelRng
+{
+    uint32_t state;
+
+    PixelRng(int x, int y, int sub)
+        : state((uint32_t)fnv1a64(&x, sizeof(x), fnv1a64(&y, sizeof(y), fnv1a64(&sub, sizeof(sub)))) | 1u) {}
+
+    float next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return std::min((state >> 8) * (1.0f / 16777216.0f), 0.99999994f);
+    }
+};
+
+AtShaderGlobals shadingPoint(const AtVector& N)
+{
+    AtShaderGlobals sg = AtShaderGlobals();
+    sg.P = N;
+    sg.N = sg.Nf = sg.Ng = sg.Ngf = sg.Ns = N;
+    sg.Rd = AtVector(0.0f, 0.0f, -1.0f);
+    sg.Rt = AI_RAY_SPECULAR_REFLECT;
+    return sg;
+}
+
+// 2x2 shading points per pixel for the silhouette, the samples are split among
+// them with the lobe selection stratified like Arnold's rnd.z
+void renderTile(const Options& opt, const Tile& tile, AtBSDF* bsdf)
+{
+    const AtBSDFMethods* methods = AiStandinBSDFMethods(bsdf);
+    const int sub = 2;
+    const int n = std::max(1, opt.spp / (sub * sub));
+    const float inv_size = 1.0f / opt.size;
+
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            AtRGB color = AI_RGB_BLACK;
+            int covered = 0;
+            for (int s = 0; s < sub * sub; ++s) {
+                const float px = 2.0f * (x + (s % sub + 0.5f) / sub) * inv_size - 1.0f;
+                const float py = 1.0f - 2.0f * (y + (s / sub + 0.5f) / sub) * inv_size;
+                const float r2 = px * px + py * py;
+                if (r2 >= 1.0f)
+                    continue;
+                ++covered;
+
+                const AtShaderGlobals sg = shadingPoint(AtVector(px, py, sqrtf(1.0f - r2)));
+                methods->Init(&sg, bsdf);
+
+                PixelRng rng(x, y, s);
+                AtRGB sum = AI_RGB_BLACK;
+                for (int i = 0; i < n; ++i) {
+                    const AtVector rnd(rng.next(), rng.next(), std::min((i + rng.next()) / n, 0.99999994f));
+                    AtVectorDv wi;
+                    int lobe = 0;
+                    AtBSDFLobeSample lobes[MLS_MAX_LAYERS];
+                    AtRGB k_r, k_t;
+                    if (methods->Sample(bsdf, rnd, 0.0f, ~0u, true, wi, lobe, lobes, k_r, k_t))
+                        sum += lobes[lobe].weight * environment(wi.val);
+                }
+                color += sum / float(n);
+            }
+
+            float* pixel = &tile.swatch->pixels[4 * (y * opt.size + x)];
+            const float coverage = covered / float(sub * sub);
+            const AtRGB c = covered ? color / float(covered) : AI_RGB_BLACK;
+            pixel[0] = c.r;
+            pixel[1] = c.g;
+            pixel[2] = c.b;
+            pixel[3] = coverage;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Output
+// ---------------------------------------------------------------------------
+
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    static const struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void putBE32(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+void putChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+    putBE32(out, (uint32_t)data.size());
+    const size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBE32(out, crc32(&out[start], out.size() - start));
+}
+
+float toSRGB(float c)
+{
+    c = _clamp(c, 0.0f, 1.0f);
+    return c <= 0.0031308f ? 12.92f * c : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// 8-bit RGBA PNG with stored (uncompressed) deflate blocks: swatches are
+// small and it keeps the tool free of a zlib dependency
+bool writePNG(const std::filesystem::path& path, const std::vector<float>& pixels, int size)
+{
+    std::vector<unsigned char> raw;
+    raw.reserve(size * (4 * size + 1));
+    for (int y = 0; y < size; ++y) {
+        raw.push_back(0); // no filter
+        for (int x = 0; x < size; ++x) {
+            const float* p = &pixels[4 * (y * size + x)];
+            for (int c = 0; c < 3; ++c)
+                raw.push_back((unsigned char)(toSRGB(p[c]) * 255.0f + 0.5f));
+            raw.push_back((unsigned char)(_clamp(p[3], 0.0f, 1.0f) * 255.0f + 0.5f));
+        }
+    }
+
+    std::vector<unsigned char> idat = { 0x78, 0x01 };
+    for (size_t pos = 0; pos < raw.size();) {
+        const size_t len = std::min<size_t>(raw.size() - pos, 65535);
+        idat.push_back(pos + len == raw.size() ? 1 : 0); // last block
+        idat.push_back((unsigned char)len);
+        idat.push_back((unsigned char)(len >> 8));
+        idat.push_back((unsigned char)~len);
+        idat.push_back((unsigned char)(~len >> 8));
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    }
+    uint32_t a = 1, b = 0;
+    for (unsigned char byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBE32(idat, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    putBE32(header, size);
+    putBE32(header, size);
+    header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bits, RGBA
+
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    putChunk(png, "IHDR", header);
+    putChunk(png, "IDAT", idat);
+    putChunk(png, "IEND", {});
+
+    // Written aside and renamed, a reader never sees a partial swatch
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out.write((const char*)png.data(), png.size()))
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+std::string hexHash(uint64_t hash)
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return buf;
+}
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: mls_swatch [options]\n"
+        "  --presets <dir>   preset directory (default %s)\n"
+        "  --cache <dir>     swatch cache directory (default swatches)\n"
+        "  --filter <name>   only presets whose name contains this\n"
+        "  --size <pixels>   swatch width and height (default 128)\n"
+        "  --spp <n>         samples per pixel (default 128)\n"
+        "  --tile <pixels>   tile size handed to the threads (default 16)\n"
+        "  --threads <n>     worker threads, 0 for all cores (default 0)\n"
+        "  --force           render even when the swatch is cached\n",
+        MLS_PRESETS_DIR);
+}
+
+bool parseArgs(int argc, char** argv, Options& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--force") {
+            opt.force = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return false;
+        }
+        if (arg == "--presets") {
+            opt.presets_dir = argv[++i];
+        } else if (arg == "--cache") {
+            opt.cache_dir = argv[++i];
+        } else if (arg == "--filter") {
+            opt.filter = argv[++i];
+        } else if (arg == "--size") {
+            opt.size = std::max(8, atoi(argv[++i]));
+        } else if (arg == "--spp") {
+            opt.spp = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--tile") {
+            opt.tile = std::max(4, atoi(argv[++i]));
+        } else if (arg == "--threads") {
+            opt.threads = std::max(0, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage();
+        return 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+
+    const std::vector<Preset> presets = preset_library::loadPresets(opt.presets_dir, opt.filter);
+    if (presets.empty()) {
+        fprintf(stderr, "no presets found in %s\n", opt.presets_dir.c_str());
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(opt.cache_dir, ec);
+    if (ec) {
+        fprintf(stderr, "couldn't create %s: %s\n", opt.cache_dir.c_str(), ec.message().c_str());
+        return 1;
+    }
+
+    // Same layers and settings, same image: the preset name isn't part of the key
+    const RenderSettings settings = { SWATCH_VERSION, opt.size, opt.spp, TABLE_TOLERANCE, addingDoublingDataHash() };
+    std::vector<Swatch> swatches(presets.size());
+    for (size_t i = 0; i < presets.size(); ++i) {
+        Swatch& swatch = swatches[i];
+        swatch.preset = &presets[i];
+        swatch.hash = fnv1a64(presets[i].layers.data(), presets[i].layers.size(), fnv1a64(&settings, sizeof(settings)));
+        swatch.path = std::filesystem::path(opt.cache_dir) / (hexHash(swatch.hash) + ".png");
+        swatch.cached = !opt.force && std::filesystem::exists(swatch.path, ec);
+    }
+
+    WorkStealingPool pool(opt.threads);
+
+    // Angular tables first, like the layerstack node builds them before shading
+    std::vector<Swatch*> pending;
+    for (Swatch& swatch : swatches) {
+        if (!swatch.cached)
+            pending.push_back(&swatch);
+    }
+    pool.parallelFor((int)pending.size(), [&](int index, int) {
+        Swatch& swatch = *pending[index];
+        float mean_error = 0.0f, max_error = 0.0f;
+        swatch.table.build(swatch.preset->stack, TABLE_TOLERANCE, mean_error, max_error);
+        swatch.pixels.assign(4 * opt.size * opt.size, 0.0f);
+    });
+
+    // Tiles of all the swatches go in one batch so the threads stay busy
+    // across presets of uneven cost
+    std::vector<Tile> tiles;
+    for (Swatch* swatch : pending) {
+        for (int y = 0; y < opt.size; y += opt.tile) {
+            for (int x = 0; x < opt.size; x += opt.tile)
+                tiles.push_back({ swatch, x, y, std::min(x + opt.tile, opt.size), std::min(y + opt.tile, opt.size) });
+        }
+    }
+
+    const clock::time_point render_start = clock::now();
+    pool.parallelFor((int)tiles.size(), [&](int index, int) {
+        const Tile& tile = tiles[index];
+        LayerStackBSDF stack = tile.swatch->preset->stack;
+        if (!tile.swatch->table.empty())
+            stack.table = &tile.swatch->table;
+
+        const AtShaderGlobals sg = shadingPoint(AtVector(0.0f, 0.0f, 1.0f));
+        AtBSDF* bsdf = LayerStackBSDFCreate(&sg, stack);
+        renderTile(opt, tile, bsdf);
+        AiStandinBSDFDestroy(bsdf);
+    });
+    const double render_s = std::chrono::duration<double>(clock::now() - render_start).count();
+
+    int rendered = 0, failed = 0;
+    for (Swatch& swatch : swatches) {
+        if (!swatch.cached) {
+            if (writePNG(swatch.path, swatch.pixels, opt.size)) {
+                ++rendered;
+            } else {
+                fprintf(stderr, "couldn't write %s\n", swatch.path.string().c_str());
+                ++failed;
+                continue;
+            }
+        }
+
+        json line;
+        line["preset"] = swatch.preset->name;
+        line["hash"] = hexHash(swatch.hash);
+        line["swatch"] = swatch.path.string();
+        line["cached"] = swatch.cached;
+        printf("%s\n", line.dump().c_str());
+    }
+
+    json summary;
+    summary["presets"] = swatches.size();
+    summary["rendered"] = rendered;
+    summary["cached"] = (int)swatches.size() - rendered - failed;
+    summary["failed"] = failed;
+    summary["threads"] = pool.numThreads();
+    summary["render_s"] = render_s;
+    summary["total_s"] = std::chrono::duration<double>(clock::now() - start).count();
+    printf("%s\n", summary.dump().c_str());
+    return failed ? 1 : 0;
+}
@@ -1,6 +1,8 @@
 #include "LayerStackCmd.h"
 #include "LayeredMaterialNode.h"
 #include "LayeredShadingGroup.h"
+#include "MaterialIR.h"
+#include "MaterialRegistry.h"
 
 #include <maya/MArgList.h>
 #include <maya/MFnMesh.h>
@@ -10,22 +12,25 @@
 #include <maya/MFnSet.h>
 #include <maya/MGlobal.h>
 #include <maya/MDagPath.h>
+#include <maya/MDagPathArray.h>
+#include <maya/MStringArray.h>
 #include <maya/MFnAttribute.h>
+#include <maya/MDGModifier.h>
+#include <maya/MObjectArray.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "external/nlohmann/json.hpp"
 
 // Global, static state. For simplicity..
-std::vector<LayeredShadingGroup*> sShadingGroups;
+MaterialRegistry sMaterialRegistry;
 void LayerStackCmd::CleanupShadingGroups()
 {
-    for (LayeredShadingGroup* group : sShadingGroups)
-    {
-        if (!group)
-            continue;
-
-        delete group;
-    }
-    sShadingGroups.clear();
+    sMaterialRegistry.Clear();
 }
 
 // Stolen from Maya Code, but added a custom log message
@@ -58,91 +63,155 @@ MStatus DebugPrintAttributes(MFnDependencyNode& fn)
     return status;
 }
 
-MStatus GetShapeNodeFromSelection(const MString& selection, MObject& out_shapeNode)
+// Resolves a space separated list of objects (wildcards allowed), or the
+// active selection when it's empty, to the DAG paths of their meshes. A
+// transform gives every mesh directly below it; a shape given by name gives
+// all of its instances.
+MStatus GetMeshPathsFromSelection(const MString& selection, MDagPathArray& out_meshPaths)
 {
     MStatus status;
-    MObject selectedObj;
-
     MSelectionList selList;
-    selList.add(selection);
-    status = selList.getDependNode(0, selectedObj);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to find shape node for selection: " + selection);
-
-    MDagPath meshPath;
-    MFnDagNode dagFn(selectedObj);
-    MObject shapeNode = dagFn.child(0, &status);
-    dagFn.getPath(meshPath);
 
-    MFnMesh meshFn(shapeNode, &status);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to create MeshFn for selection: " + selection);
+    MStringArray names;
+    selection.split(' ', names);
+    if (names.length() == 0)
+    {
+        status = MGlobal::getActiveSelectionList(selList);
+        LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to get the active selection");
+    }
 
-    out_shapeNode = shapeNode;
-    return status;
-}
+    for (unsigned int i = 0; i < names.length(); ++i)
+    {
+        if (names[i].length() == 0)
+            continue;
 
-MStatus DisconnectFromCurrentShadingGroup(MObject& shapeObj)
-{
-    MStatus status;
-    MFnMesh meshFn(shapeObj, &status);
-#define USE_CPP 0 
-#if USE_CPP
+        status = selList.add(names[i]);
+        LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to find object: " + names[i]);
+    }
 
-    MDGModifier dgModifier;
-    MFnDagNode meshDagNode(shapeObj);
+    std::unordered_set<std::string> seen;
+    auto addMeshPath = [&](const MDagPath& path)
+    {
+        if (path.hasFn(MFn::kMesh) && seen.insert(path.fullPathName().asChar()).second)
+        {
+            out_meshPaths.append(path);
+        }
+    };
 
-    // Find the instObjGroups plug on the mesh
-    MPlug instObjGroupsPlug = meshDagNode.findPlug("instObjGroups", false, &status);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to find instObjGroups on " + meshDagNode.name());
+    for (unsigned int i = 0; i < selList.length(); ++i)
+    {
+        MDagPath path;
+        if (selList.getDagPath(i, path) != MStatus::kSuccess)
+            continue; // Not a DAG node
 
-    MPlug element = instObjGroupsPlug.elementByLogicalIndex(0);
+        if (path.node().hasFn(MFn::kMesh))
+        {
+            MDagPathArray instances;
+            MDagPath::getAllPathsTo(path.node(), instances);
+            for (unsigned int j = 0; j < instances.length(); ++j)
+            {
+                addMeshPath(instances[j]);
+            }
+            continue;
+        }
 
-    // Check if this element is already connected
-    MPlugArray connections;
-    element.connectedTo(connections, false, true);
+        unsigned int numShapes = 0;
+        path.numberOfShapesDirectlyBelow(numShapes);
+        for (unsigned int j = 0; j < numShapes; ++j)
+        {
+            MDagPath shapePath(path);
+            if (shapePath.extendToShapeDirectlyBelow(j) == MStatus::kSuccess)
+            {
+                addMeshPath(shapePath);
+            }
+        }
+    }
 
-    if (connections.length() > 0) {
-        for (unsigned int i = 0; i < connections.length(); i++) {
-            MObject connectedNode = connections[i].node();
-            MFnDependencyNode nodeFn(connectedNode);
+    if (out_meshPaths.length() == 0)
+    {
+        MGlobal::displayError("[LayerStack] No mesh found in: " + (names.length() ? selection : MString("the selection")));
+        return MStatus::kNotFound;
+    }
 
-            if (connectedNode.apiType() == MFn::kShadingEngine) {
+    return MStatus::kSuccess;
+}
 
-                // Found a shading group
-                MGlobal::displayInfo("Disconnecting " + meshFn.name() + " from shading group: " + nodeFn.name());
+// Moves all the meshes to the shading group, like "sets -forceElement" but
+// without going through MEL. A mesh can only be in one shading group, so the
+// given instances (and their per-face assignments) first leave their current
+// ones, one removeMembers per group.
+MStatus AssignToLayeredShadingGroup(const MDagPathArray& meshPaths, LayeredShadingGroup& shadingGroup)
+{
+    MStatus status;
+    MSelectionList members;
+    std::vector<std::pair<MObject, MSelectionList>> previousSets;
+    for (unsigned int i = 0; i < meshPaths.length(); ++i)
+    {
+        const MDagPath& path = meshPaths[i];
+        status = members.add(path);
+        LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "[LayerStack] Failed to add " + path.fullPathName() + " to the assignment");
 
-                // Disconnect existing connection first
-                status = dgModifier.disconnect(element, connections[0]);
-                LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to disconnect from existing shadingGroup");
+        MObjectArray sets, components;
+        status = MFnMesh(path).getConnectedSetsAndMembers(path.instanceNumber(), sets, components, true);
+        LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "[LayerStack] Failed to get the shading groups of " + path.fullPathName());
 
-                status = dgModifier.doIt();
-                LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to doit() disconnect from existing shadingGroup");
+        for (unsigned int j = 0; j < sets.length(); ++j)
+        {
+            if (sets[j] == shadingGroup.mObject)
+                continue;
+
+            auto previous = std::find_if(previousSets.begin(), previousSets.end(),
+                [&](const std::pair<MObject, MSelectionList>& set) { return set.first == sets[j]; });
+            if (previous == previousSets.end())
+            {
+                previousSets.emplace_back(sets[j], MSelectionList());
+                previous = previousSets.end() - 1;
             }
+            previous->second.add(path, components[j]);
         }
     }
-#else
-    MString findShadingGroupsCmd = "listConnections -destination true -type \"shadingEngine\" " + meshFn.name() + ";";
-    MStringArray shadingGroupNameResult;
-    status = MGlobal::executeCommand(findShadingGroupsCmd, shadingGroupNameResult);
 
-    if (shadingGroupNameResult.length() > 0)
+    for (const auto& previous : previousSets)
     {
-        MString shadingGroupName = shadingGroupNameResult[0];
-        MString disconnectShadingGroupCmd = "sets -rm " + shadingGroupName + " " + meshFn.name();
-        MGlobal::executeCommand(disconnectShadingGroupCmd, true);
+        MFnSet previousFn(previous.first);
+        status = previousFn.removeMembers(previous.second);
+        LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "[LayerStack] Failed to remove the meshes from " + previousFn.name());
     }
-#endif
 
-    return status;
+    MFnSet setFn(shadingGroup.mObject, &status);
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "[LayerStack] " + shadingGroup.mName + " is not a set");
+    return setFn.addMembers(members);
 }
 
-MStatus ConnectToLayeredShadingGroup(MObject& shapeObj, LayeredShadingGroup& shadingGroup)
+// Moves the meshes of a group no material name uses anymore to newGroup, then
+// deletes its network and shading group
+MStatus RetireShadingGroup(LayeredShadingGroup* pOldGroup, LayeredShadingGroup& newGroup)
 {
     MStatus status;
-    MFnMesh meshFn(shapeObj, &status);
-
-    //MString cmd = "connectAttr -f " + meshFn.name() + ".instObjGroups[0] " + shadingGroup.mName + ".dagSetMembers[0]";
-    MString cmd = "sets -addElement " + shadingGroup.mName + " " + meshFn.name();
-    return MGlobal::executeCommand(cmd);
+    MFnSet oldSetFn(pOldGroup->mObject, &status);
+    MSelectionList members;
+    if (status == MStatus::kSuccess)
+        status = oldSetFn.getMembers(members, false);
+    if (status == MStatus::kSuccess && !members.isEmpty())
+    {
+        status = oldSetFn.removeMembers(members);
+        if (status == MStatus::kSuccess)
+            status = MFnSet(newGroup.mObject).addMembers(members);
+    }
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "[LayerStack] Failed to move the meshes of " + pOldGroup->mName + " to " + newGroup.mName);
+
+    MDGModifier deleteMod;
+    if (pOldGroup->mMaterialRoot)
+        pOldGroup->mMaterialRoot->Delete(deleteMod);
+    deleteMod.deleteNode(pOldGroup->mObject);
+    status = deleteMod.doIt();
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "[LayerStack] Failed to delete " + pOldGroup->mName);
+
+    MGlobal::displayInfo("[LayerStack] Deleted " + pOldGroup->mName + ", its meshes moved to " + newGroup.mName);
+    delete pOldGroup->mMaterialRoot;
+    pOldGroup->mMaterialRoot = nullptr;
+    sMaterialRegistry.Remove(pOldGroup);
+    return MStatus::kSuccess;
 }
 
 LayerStackCmd::LayerStackCmd() : MPxCommand()
@@ -157,105 +226,340 @@ MStatus LayerStackCmd::doIt( const MArgList& args )
 {
     using json = nlohmann::json;
     MStatus status;
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 
     if (args.length() < 3)
     {
-        MGlobal::displayError("You must pass the mesh, the json structure, and the desired material as an argument.");
+        MGlobal::displayError("You must pass the meshes (empty for the selection), the json structure, and the desired material as an argument.");
         return MS::kFailure;
     }
 
-    // Get the mesh name passed as an argument
+    // Space separated mesh names, or empty for the current selection
     MString selectedStr = args.asString(0);
     MString jsonComplete = args.asString(1);
     MString materialName = args.asString(2);
+
+    // Optional flags after the positional arguments
+    // -flatten: a single mlsLayeredSurface holding the layers in array attributes
+    bool bFlatten = false;
+    for (unsigned int i = 3; i < args.length(); ++i)
+    {
+        MString flag = args.asString(i);
+        if (flag == "-flatten" || flag == "-fl")
+        {
+            bFlatten = true;
+        }
+        else
+        {
+            MGlobal::displayWarning("[LayerStack] Ignoring unknown flag: " + flag);
+        }
+    }
     const char* testName = materialName.asChar();
     const wchar_t* testName2 = materialName.asWChar();
 
-    // Look up the shape node from the name
-    MObject shapeNode;
-    status = GetShapeNodeFromSelection(selectedStr, shapeNode);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to fetch shape node from selection: " + selectedStr);
+    // Look up the mesh instances first, the material is built once for all of them
+    MDagPathArray meshPaths;
+    status = GetMeshPathsFromSelection(selectedStr, meshPaths);
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to fetch meshes from selection: " + selectedStr);
 
-    MFnMesh meshFn(shapeNode);
+    // The JSON is compiled once, building and hashing the material only walk the IR
+    MaterialIR materialIR;
+    status = CompileMaterialIR(jsonComplete.asChar(), materialIR);
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to read the json structure");
 
-    LayeredShadingGroup* pShadingGroup = FindShadingGroupForMaterialName(materialName);
-    if (pShadingGroup)
+    const std::string materialKey(materialName.asChar());
+    const int materialIndex = materialIR.FindMaterial(materialKey);
+    if (materialIndex < 0)
     {
-        MGlobal::displayInfo("[LayerStack] Found existing shading group: " + pShadingGroup->mName + "\n");
+        MGlobal::displayError("[LayerStack] Failed to find material " + materialName + " in the json structure");
+        return MStatus::kNotFound;
     }
 
-    if (!pShadingGroup)
+    std::vector<MaterialRequest> requests(1, MaterialRequest{ &materialIR, materialIndex, materialName });
+    std::vector<LayeredShadingGroup*> shadingGroups;
+    std::vector<ApplyResult> results;
+    status = ApplyMaterials(requests, bFlatten, shadingGroups, &results);
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to apply material " + materialName);
+    LayeredShadingGroup* pShadingGroup = shadingGroups[0];
+
+    // Move all the meshes to the shading group at once
+    const std::chrono::steady_clock::time_point assignTime = std::chrono::steady_clock::now();
+    status = AssignToLayeredShadingGroup(meshPaths, *pShadingGroup);
+    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to assign the meshes to " + pShadingGroup->mName);
+
+    const std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+    const double elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    const double assignMs = std::chrono::duration<double, std::milli>(endTime - assignTime).count();
+    const char* action = results[0] == AR_REUSED ? "Reused " : (results[0] == AR_UPDATED ? "Updated " : "Applied ");
+    MGlobal::displayInfo(MString("[LayerStack] ") + action + materialName + " to "
+        + meshPaths.length() + " mesh(es) in " + elapsedMs + " ms (assignment " + assignMs + " ms)");
+
+    return status;
+}
+
+MStatus LayerStackCmd::ApplyMaterials(const std::vector<MaterialRequest>& requests, bool bFlatten,
+    std::vector<LayeredShadingGroup*>& outGroups, std::vector<ApplyResult>* pOutResults)
+{
+    MStatus status = MStatus::kSuccess;
+    outGroups.assign(requests.size(), nullptr);
+    std::vector<ApplyResult> results(requests.size(), AR_FAILED);
+
+    // New networks, each queued on its own modifier so that a material that
+    // fails to build can be dropped alone. Registered by content once built.
+    struct PendingBuild
     {
-        // Need to create a new one.
-        pShadingGroup = CreateNewShadingGroup(materialName);
-        if (!pShadingGroup)
+        size_t request;
+        LayeredShadingGroup* pGroup;
+        uint64_t contentHash;
+        std::string content;
+        bool bNewGroup;
+        std::unique_ptr<MDGModifier> pBuildMod;
+    };
+    std::vector<PendingBuild> pendingBuilds;
+    std::unordered_map<uint64_t, size_t> pendingByHash;
+
+    // Materials sharing a network that isn't built yet. They are bound to it,
+    // and their old group retired, only once it is.
+    struct PendingShare
+    {
+        size_t request;
+        size_t build;
+        LayeredShadingGroup* pOldGroup;
+    };
+    std::vector<PendingShare> pendingShares;
+
+    // Drops the tree of a network that couldn't be built. An existing group
+    // keeps its name and shading group, the next apply rebuilds its network;
+    // a group created for it is deleted.
+    const auto discardBuild = [](LayeredShadingGroup* pGroup, bool bNewGroup)
+    {
+        delete pGroup->mMaterialRoot;
+        pGroup->mMaterialRoot = nullptr;
+        if (!bNewGroup)
+            return;
+
+        MDGModifier deleteMod;
+        deleteMod.deleteNode(pGroup->mObject);
+        deleteMod.doIt();
+        sMaterialRegistry.Remove(pGroup);
+    };
+
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        const MaterialRequest& request = requests[i];
+        MString materialName = request.name;
+        const std::string materialKey(materialName.asChar());
+
+        // Materials with the same layers share one network and shading group, whatever their names
+        const std::string content = MaterialIRContent(*request.pIR, request.materialIndex, bFlatten);
+        const uint64_t contentHash = HashMaterialContent(content);
+        LayeredShadingGroup* pShadingGroup = sMaterialRegistry.FindByName(materialKey);
+        LayeredShadingGroup* pSameContentGroup = sMaterialRegistry.FindByContent(contentHash, content);
+        if (!pSameContentGroup)
         {
-            MGlobal::displayError("[LayerStack] Fatal Error: Failed to allocate new shading group");
-            return MStatus::kFailure;
+            auto pending = pendingByHash.find(contentHash);
+            if (pending != pendingByHash.end() && pendingBuilds[pending->second].content == content)
+            {
+                // Same content as a network of this batch. A group that is itself
+                // being built isn't retired, it may not survive the batch.
+                if (pShadingGroup != pendingBuilds[pending->second].pGroup)
+                {
+                    const bool bOldPending = std::any_of(pendingBuilds.begin(), pendingBuilds.end(),
+                        [&](const PendingBuild& build) { return build.pGroup == pShadingGroup; });
+                    pendingShares.push_back(PendingShare{ i, pending->second, bOldPending ? nullptr : pShadingGroup });
+                }
+                outGroups[i] = pendingBuilds[pending->second].pGroup;
+                results[i] = AR_REUSED;
+                continue;
+            }
         }
-    }
 
-    if (!pShadingGroup)
-    {
-        throw std::exception("[LayerStack] Error: Failed to create shading group!");
-        return MStatus::kFailure;
-    }
+        if (pSameContentGroup && pSameContentGroup->mMaterialRoot)
+        {
+            // Nothing to build, the material is already in the scene
+            if (pShadingGroup != pSameContentGroup)
+            {
+                MGlobal::displayInfo("[LayerStack] " + materialName + " shares shading group " + pSameContentGroup->mName);
+                sMaterialRegistry.Bind(materialKey, pSameContentGroup);
+
+                // It was the last material of its old group, its meshes follow it
+                if (pShadingGroup && pShadingGroup->mNameCount == 0
+                    && std::find(outGroups.begin(), outGroups.end(), pShadingGroup) == outGroups.end())
+                {
+                    MStatus retireStatus = RetireShadingGroup(pShadingGroup, *pSameContentGroup);
+                    if (retireStatus != MStatus::kSuccess)
+                        status = retireStatus;
+                }
+            }
+            outGroups[i] = pSameContentGroup;
+            results[i] = AR_REUSED;
+            continue;
+        }
+        else if (pShadingGroup && pShadingGroup->mNameCount > 1)
+        {
+            // Other materials still use the old content, this one moves to its own group
+            sMaterialRegistry.Unbind(materialKey);
+            pShadingGroup = nullptr;
+        }
 
-    // Even if the group already exists, the user may have modified properties, so need to re-init from the latest JSON.
-    if (pShadingGroup->mMaterialRoot)
-    {
-        pShadingGroup->mMaterialRoot->Delete();
-        delete pShadingGroup->mMaterialRoot;
-        pShadingGroup->mMaterialRoot = nullptr;
-    }
+        if (pShadingGroup)
+        {
+            MGlobal::displayInfo("[LayerStack] Found existing shading group: " + pShadingGroup->mName + "\n");
+        }
 
-    status = pShadingGroup->AssignMaterial(nullptr, materialName);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to assign material to SG");
+        const bool bNewGroup = !pShadingGroup;
+        if (!pShadingGroup)
+        {
+            // Need to create a new one.
+            pShadingGroup = CreateNewShadingGroup(materialName);
+            if (!pShadingGroup)
+            {
+                MGlobal::displayError("[LayerStack] Fatal Error: Failed to allocate new shading group");
+                status = MStatus::kFailure;
+                continue;
+            }
+        }
 
-    status = pShadingGroup->mMaterialRoot->InitFromJSON(jsonComplete, materialName);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to init default material tree");
+        // Even if the group already exists, the user may have modified properties, so need to re-init from the latest JSON.
+        // The applied network is patched in place when possible: only changed attributes are set
+        // and only the subtrees whose structure changed are rebuilt.
+        if (pShadingGroup->mMaterialRoot)
+        {
+            MDGModifier deleteMod;
+            MDGModifier dgMod;
+            MStatus updateStatus = pShadingGroup->mMaterialRoot->UpdateFromIR(*request.pIR, request.materialIndex, deleteMod, dgMod, bFlatten);
+
+            // Both run even on failure, the tree no longer references the queued deletions
+            MStatus doItStatus = deleteMod.doIt();
+            if (doItStatus != MStatus::kSuccess)
+            {
+                MGlobal::displayError("[LayerStack] Failed to delete the replaced nodes of " + materialName);
+                status = doItStatus;
+            }
+            const MStatus dgModStatus = dgMod.doIt();
+            doItStatus = doItStatus == MStatus::kSuccess ? dgModStatus : doItStatus;
+            pShadingGroup->mMaterialRoot->UpdateNames();
+
+            if (updateStatus == MStatus::kSuccess && doItStatus == MStatus::kSuccess)
+            {
+                sMaterialRegistry.Rehash(pShadingGroup, contentHash, content);
+                outGroups[i] = pShadingGroup;
+                results[i] = AR_UPDATED;
+                continue;
+            }
 
-    // Disconnect the mesh from any existing shading group
-    status = DisconnectFromCurrentShadingGroup(shapeNode);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to disconnect " + meshFn.name() + " from current SG");
+            MGlobal::displayInfo("[LayerStack] Can't update " + materialName + " in place, rebuilding it");
 
-    // Connect the mesh to the shading group.
-    status = ConnectToLayeredShadingGroup(shapeNode, *pShadingGroup);
-    LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to connect " + meshFn.name() + " to layered SG");
+            // The old network is deleted on its own, so the new nodes can take back its names
+            MDGModifier rebuildDeleteMod;
+            pShadingGroup->mMaterialRoot->Delete(rebuildDeleteMod);
+            MStatus deleteStatus = rebuildDeleteMod.doIt();
+            if (deleteStatus != MStatus::kSuccess)
+            {
+                MGlobal::displayError("[LayerStack] Failed to delete the network of " + materialName + ", its nodes may be left in the scene");
+                status = deleteStatus;
+            }
+            delete pShadingGroup->mMaterialRoot;
+            pShadingGroup->mMaterialRoot = nullptr;
+        }
 
-    return status;
-}
+        // The network is only queued here, the modifiers run once every material is resolved.
+        // A material that can't be queued entirely is dropped with its modifier: none of its
+        // nodes get built.
+        std::unique_ptr<MDGModifier> pBuildMod(new MDGModifier);
+        MStatus buildStatus = pShadingGroup->AssignMaterial(nullptr, materialName, *pBuildMod);
+        if (buildStatus == MStatus::kSuccess)
+        {
+            buildStatus = pShadingGroup->mMaterialRoot->InitFromIR(*request.pIR, request.materialIndex, *pBuildMod, bFlatten);
+        }
+        if (buildStatus != MStatus::kSuccess)
+        {
+            MGlobal::displayError("[LayerStack] Failed to init the material tree of " + materialName);
+            discardBuild(pShadingGroup, bNewGroup);
+            status = buildStatus;
+            continue;
+        }
 
-// Linear search is OK here since there probably won't be too many shading groups
-LayeredShadingGroup* LayerStackCmd::FindShadingGroupForMaterialName(MString& materialName)
-{
-    LayeredShadingGroup* ret = nullptr;
+        pendingByHash.emplace(contentHash, pendingBuilds.size());
+        pendingBuilds.push_back(PendingBuild{ i, pShadingGroup, contentHash, content, bNewGroup, std::move(pBuildMod) });
+        outGroups[i] = pShadingGroup;
+    }
 
-    const char* targetCStr = materialName.asChar();
-    std::string targetStr(targetCStr);
+    std::vector<bool> built(pendingBuilds.size(), false);
+    for (size_t b = 0; b < pendingBuilds.size(); ++b)
+    {
+        PendingBuild& build = pendingBuilds[b];
+        MStatus buildStatus = build.pBuildMod->doIt();
+        if (buildStatus != MStatus::kSuccess)
+        {
+            MGlobal::displayError("[LayerStack] Failed to build the material network of " + requests[build.request].name);
+            build.pBuildMod->undoIt();
+
+            // Including the materials that were going to share it
+            for (size_t i = 0; i < requests.size(); ++i)
+            {
+                if (outGroups[i] != build.pGroup)
+                    continue;
+                outGroups[i] = nullptr;
+                results[i] = AR_FAILED;
+            }
+            discardBuild(build.pGroup, build.bNewGroup);
+            status = buildStatus;
+            continue;
+        }
+
+        // Registered by content only once the network is built
+        build.pGroup->mMaterialRoot->UpdateNames();
+        sMaterialRegistry.Rehash(build.pGroup, build.contentHash, build.content);
+        results[build.request] = AR_BUILT;
+        built[b] = true;
+    }
 
-    for (LayeredShadingGroup* group : sShadingGroups)
+    for (const PendingShare& share : pendingShares)
     {
-        if (!group || !group->mMaterialRoot)
+        if (!built[share.build])
             continue;
 
-        // If the surface material name matches, return it so we don't have to create a new one. 
-        if (materialName == group->mMaterialRoot->mInstanceName)
+        LayeredShadingGroup* pSharedGroup = pendingBuilds[share.build].pGroup;
+        MGlobal::displayInfo("[LayerStack] " + requests[share.request].name + " shares shading group " + pSharedGroup->mName);
+        sMaterialRegistry.Bind(requests[share.request].name.asChar(), pSharedGroup);
+
+        // It was the last material of its old group, its meshes follow it
+        if (share.pOldGroup && share.pOldGroup->mNameCount == 0
+            && std::find(outGroups.begin(), outGroups.end(), share.pOldGroup) == outGroups.end())
         {
-            ret = group;
-            break;
+            MStatus retireStatus = RetireShadingGroup(share.pOldGroup, *pSharedGroup);
+            if (retireStatus != MStatus::kSuccess)
+                status = retireStatus;
         }
     }
 
-    return ret;
+    if (pOutResults)
+    {
+        *pOutResults = std::move(results);
+    }
+    return status;
 }
 
 LayeredShadingGroup* LayerStackCmd::CreateNewShadingGroup(MString& materialName)
 {
     LayeredShadingGroup* newGroup = new LayeredShadingGroup();
-    sShadingGroups.push_back(newGroup);
-    newGroup->Create(materialName);
+    if (newGroup->Create(materialName) != MStatus::kSuccess)
+    {
+        // The set may exist even when it couldn't be named
+        if (!newGroup->mObject.isNull())
+        {
+            MDGModifier deleteMod;
+            deleteMod.deleteNode(newGroup->mObject);
+            deleteMod.doIt();
+        }
+        delete newGroup;
+        return nullptr;
+    }
 
+    // Only bound once it exists in the scene
+    sMaterialRegistry.Add(newGroup);
+    sMaterialRegistry.Bind(materialName.asChar(), newGroup);
     return newGroup;
 }
 
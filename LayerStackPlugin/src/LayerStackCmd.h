@@ -8,6 +8,7 @@
 #include <unordered_map>
 
 struct LayeredShadingGroup;
+struct MaterialIR;
 
 class LayerStackCmd : public MPxCommand
 {
@@ -19,8 +20,29 @@ public:
     static void CleanupShadingGroups();
     MStatus doIt( const MArgList& args );
 
-    LayeredShadingGroup* FindShadingGroupForMaterialName(MString& materialName);
-    LayeredShadingGroup* CreateNewShadingGroup(MString& materialName);
+    // A material of a compiled JSON to bring into the scene
+    struct MaterialRequest
+    {
+        const MaterialIR* pIR;
+        int materialIndex;
+        MString name;
+    };
+
+    enum ApplyResult
+    {
+        AR_FAILED,
+        AR_REUSED,  // Same content as a material already in the scene
+        AR_UPDATED, // Its network was patched in place
+        AR_BUILT
+    };
+
+    // Reuses, updates or builds the shading group of each material. The new
+    // networks are queued first, each on its own modifier, and built once
+    // every material is resolved; one that fails is dropped on its own.
+    static MStatus ApplyMaterials(const std::vector<MaterialRequest>& requests, bool bFlatten,
+        std::vector<LayeredShadingGroup*>& outGroups, std::vector<ApplyResult>* pOutResults = nullptr);
+
+    static LayeredShadingGroup* CreateNewShadingGroup(MString& materialName);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "LayerStackImportCmd.h"
+#include "LayerStackCmd.h"
+#include "LayeredShadingGroup.h"
+#include "MaterialIR.h"
+
+#include <maya/MArgList.h>
+#include <maya/MGlobal.h>
+#include <maya/MStringArray.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "work_stealing_pool.h"
+
+namespace
+{
+    // A preset file, read and compiled on a worker thread
+    struct LibraryFile
+    {
+        std::string path;
+        MaterialIR ir;
+        // Messages are kept for the main thread, the Maya API isn't thread safe
+        std::vector<std::string> messages;
+        bool bCompiled = false;
+        double parseMs = 0.0;
+    };
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void CompileLibraryFile(LibraryFile& file)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::ifstream stream(file.path, std::ios::binary);
+        if (!stream)
+        {
+            file.messages.push_back("[LayerStack] ERROR: Can't read " + file.path);
+            return;
+        }
+        const std::string jsonStr((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+        file.bCompiled = CompileMaterialIR(jsonStr.c_str(), file.ir, &file.messages) == MStatus::kSuccess;
+        file.parseMs = MillisecondsSince(start);
+    }
+
+    // The .json files of a directory sorted by name, or the file itself
+    bool CollectLibraryFiles(const std::string& path, std::vector<LibraryFile>& outFiles)
+    {
+        namespace fs = std::filesystem;
+
+        std::error_code error;
+        if (!fs::is_directory(path, error))
+        {
+            if (!fs::is_regular_file(path, error))
+                return false;
+
+            outFiles.emplace_back();
+            outFiles.back().path = path;
+            return true;
+        }
+
+        std::vector<std::string> paths;
+        for (const fs::directory_entry& entry : fs::directory_iterator(path, error))
+        {
+            if (entry.is_regular_file(error) && entry.path().extension() == ".json")
+            {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+
+        outFiles.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            outFiles[i].path = paths[i];
+        }
+        return true;
+    }
+}
+
+LayerStackImportCmd::LayerStackImportCmd() : MPxCommand()
+{
+}
+
+LayerStackImportCmd::~LayerStackImportCmd()
+{
+}
+
+MStatus LayerStackImportCmd::doIt( const MArgList& args )
+{
+    MStatus status;
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    if (args.length() < 1)
+    {
+        MGlobal::displayError("You must pass a preset directory or a material library file as an argument.");
+        return MS::kFailure;
+    }
+
+    MString libraryPath = args.asString(0);
+
+    // Optional flags after the path, like applyMultiLayerMaterial
+    // -flatten: a single mlsLayeredSurface holding the layers in array attributes
+    bool bFlatten = false;
+    for (unsigned int i = 1; i < args.length(); ++i)
+    {
+        MString flag = args.asString(i);
+        if (flag == "-flatten" || flag == "-fl")
+        {
+            bFlatten = true;
+        }
+        else
+        {
+            MGlobal::displayWarning("[LayerStack] Ignoring unknown flag: " + flag);
+        }
+    }
+
+    std::vector<LibraryFile> files;
+    if (!CollectLibraryFiles(libraryPath.asChar(), files))
+    {
+        MGlobal::displayError("[LayerStack] ERROR: " + libraryPath + " is neither a directory nor a file");
+        return MStatus::kNotFound;
+    }
+
+    // Parsing and validation only touch the files and their IR
+    const std::chrono::steady_clock::time_point parseStart = std::chrono::steady_clock::now();
+    WorkStealingPool pool;
+    pool.parallelFor((int)files.size(), [&files](int index, int) { CompileLibraryFile(files[index]); });
+    const double parseMs = MillisecondsSince(parseStart);
+
+    // Materials are applied in file order, then in document order. A name
+    // seen in an earlier file wins.
+    std::vector<LayerStackCmd::MaterialRequest> requests;
+    std::unordered_set<std::string> materialNames;
+    for (LibraryFile& file : files)
+    {
+        for (const std::string& message : file.messages)
+        {
+            MGlobal::displayWarning(MString(message.c_str()));
+        }
+        if (!file.bCompiled)
+            continue;
+
+        std::vector<std::pair<int, std::string>> materials;
+        for (const auto& material : file.ir.materials)
+        {
+            materials.emplace_back(material.second, material.first);
+        }
+        std::sort(materials.begin(), materials.end());
+
+        for (const auto& material : materials)
+        {
+            if (!materialNames.insert(material.second).second)
+            {
+                MGlobal::displayWarning("[LayerStack] Warning: " + MString(material.second.c_str()) + " in " + MString(file.path.c_str()) + " was already imported, skipped");
+                continue;
+            }
+            requests.push_back(LayerStackCmd::MaterialRequest{ &file.ir, material.first, MString(material.second.c_str()) });
+        }
+
+        MGlobal::displayInfo("[LayerStack] " + MString(file.path.c_str()) + ": " + (unsigned int)materials.size() + " material(s) parsed in " + file.parseMs + " ms");
+    }
+
+    // Maya graph edits, the new networks are built by a single modifier
+    const std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+    std::vector<LayeredShadingGroup*> shadingGroups;
+    std::vector<LayerStackCmd::ApplyResult> results;
+    status = LayerStackCmd::ApplyMaterials(requests, bFlatten, shadingGroups, &results);
+    const double buildMs = MillisecondsSince(buildStart);
+
+    unsigned int counts[4] = { 0, 0, 0, 0 };
+    MStringArray shadingGroupNames;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        counts[results[i]]++;
+        if (shadingGroups[i])
+        {
+            shadingGroupNames.append(shadingGroups[i]->mName);
+        }
+    }
+    setResult(shadingGroupNames);
+
+    MGlobal::displayInfo(MString("[LayerStack] Imported ") + (unsigned int)requests.size() + " material(s) from "
+        + (unsigned int)files.size() + " file(s) in " + MillisecondsSince(startTime) + " ms: "
+        + counts[LayerStackCmd::AR_BUILT] + " built, " + counts[LayerStackCmd::AR_UPDATED] + " updated, "
+        + counts[LayerStackCmd::AR_REUSED] + " shared, " + counts[LayerStackCmd::AR_FAILED] + " failed. "
+        + "Parsing " + parseMs + " ms on " + pool.numThreads() + " threads, graph edits " + buildMs + " ms");
+
+    return status;
+}
@@ -0,0 +1,19 @@
+#ifndef LayerStackImportCmd_H_
+#define LayerStackImportCmd_H_
+
+#include <maya/MPxCommand.h>
+
+// Imports every material of a preset directory or library file in one call.
+// Files are parsed and validated in parallel, the Maya graph is then edited
+// on the main thread in a single batch.
+class LayerStackImportCmd : public MPxCommand
+{
+public:
+    LayerStackImportCmd();
+    virtual ~LayerStackImportCmd();
+    static void* creator() { return new LayerStackImportCmd(); }
+    static const char* name() { return "importMultiLayerMaterialLibrary"; }
+    MStatus doIt( const MArgList& args );
+};
+
+#endif
@@ -1,13 +1,22 @@
 #include "LayeredMaterialNode.h"
 
 #include <maya/Mstring.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MPlug.h>
+#include <maya/MIntArray.h>
 
-#define LAYERSTACK_ENABLE_CMD_LOGGING 1
+#include <algorithm>
+
+// Logs every queued graph edit. Off by default, it floods the script editor
+// when applying large libraries.
+#ifndef LAYERSTACK_ENABLE_CMD_LOGGING
+#define LAYERSTACK_ENABLE_CMD_LOGGING 0
+#endif
 
 #if LAYERSTACK_ENABLE_CMD_LOGGING
 #define LAYERSTACK_CMD_LOG(mstr) \
 do {\
-	MGlobal::displayInfo("[LayerStack] Executing Command: " + mstr);\
+	MGlobal::displayInfo("[LayerStack] Queued: " + (mstr));\
 } while(0)
 #else
 #define LAYERSTACK_CMD_LOG(mstr)
@@ -30,62 +39,87 @@ MString GetNodeTypeName(NodeType t)
 	return MString(sNodeNames[t]);
 }
 
-MStatus ExecuteNodeCreation(NodeType t, MString& outName, const char* pDesiredName)
+MObject QueueNodeCreation(NodeType t, MDGModifier& dgMod, const char* pDesiredName, MStatus* pStatus)
 {
-	MString cmd = "createNode " + GetNodeTypeName(t);
+	MString log = "createNode " + GetNodeTypeName(t);
 	if (pDesiredName)
 	{
-		cmd += " -n " + MString(pDesiredName);
+		log += " -n " + MString(pDesiredName);
+	}
+	LAYERSTACK_CMD_LOG(log);
+
+	MStatus status;
+	MObject node = dgMod.createNode(GetNodeTypeName(t), &status);
+	if (status == MStatus::kSuccess && pDesiredName)
+	{
+		status = dgMod.renameNode(node, MString(pDesiredName));
 	}
-	LAYERSTACK_CMD_LOG(cmd);
-	return MGlobal::executeCommand(cmd, outName);
+
+	if (pStatus)
+	{
+		*pStatus = status;
+	}
+	return node;
 }
 
-MStatus ExecuteNodeDeletion(MString& name)
+// Looks up an attribute of a node that may not have been added to the graph yet
+MPlug FindPlug(const MObject& node, const MString& attrName, MStatus* pStatus)
 {
-	MString cmd = "delete " + name;
-	LAYERSTACK_CMD_LOG(cmd);
-	return MGlobal::executeCommand(cmd);
+	MFnDependencyNode nodeFn(node);
+	return nodeFn.findPlug(attrName, true, pStatus);
 }
 
-std::string GetSetVec3Command(MString& mayaName, const std::string& paramName, nlohmann::json& jsonVec3)
+MStatus QueueVec3ParamSet(MDGModifier& dgMod, const MPlug& plug, float x, float y, float z)
 {
-	MString cmd = "setAttr \"" + mayaName + "." + MString(paramName.c_str()) + "\" -type double3 "
-		+ jsonVec3[0].get<float>() + MString(" ")
-		+ jsonVec3[1].get<float>() + MString(" ")
-		+ jsonVec3[2].get<float>() + MString(";");
+	if (plug.numChildren() != 3)
+	{
+		return MStatus::kInvalidParameter;
+	}
 
-	LAYERSTACK_CMD_LOG(cmd);
-	return std::string(cmd.asChar());
+	LAYERSTACK_CMD_LOG("setAttr " + plug.name() + " " + x + " " + y + " " + z);
+	const float values[3] = { x, y, z };
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		MStatus status = dgMod.newPlugValueFloat(plug.child(i), values[i]);
+		if (status != MStatus::kSuccess)
+			return status;
+	}
+	return MStatus::kSuccess;
 }
 
-std::string GetSetFloatCommand(MString& mayaName, const std::string& paramName, float val)
+MStatus QueueFloatParamSet(MDGModifier& dgMod, const MPlug& plug, float val)
 {
-	MString cmd = "setAttr \"" + mayaName + "." + MString(paramName.c_str()) + MString("\" ") + val + MString(";");
-	LAYERSTACK_CMD_LOG(cmd);
-	return std::string(cmd.asChar());
+	LAYERSTACK_CMD_LOG("setAttr " + plug.name() + " " + val);
+	return dgMod.newPlugValueFloat(plug, val);
 }
 
-MStatus ExecuteVec3ParamSet(MString& mayaName, const std::string& paramName, nlohmann::json& jsonVec3)
+// Whether the plug (a float or a float3) already holds the values. Compares
+// against the scene, so values edited in the Attribute Editor are reset too.
+static bool PlugHasValues(const MPlug& plug, const float* values, unsigned int size)
 {
-	//setAttr "mlsLayerMetal1.albedo" - type double3 0.5229 0.564635 0.747;
-	MString cmd = "setAttr \"" + mayaName + "." + MString(paramName.c_str()) + "\" -type double3 "
-		+ jsonVec3[0].get<float>() + MString(" ")
-		+ jsonVec3[1].get<float>() + MString(" ")
-		+ jsonVec3[2].get<float>() + MString(";");
-	
-
-	LAYERSTACK_CMD_LOG(cmd);
-	return MGlobal::executeCommand(cmd);
+	MStatus status;
+	if (size == 3)
+	{
+		if (plug.numChildren() != 3)
+			return false;
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			if (plug.child(i).asFloat(&status) != values[i] || status != MStatus::kSuccess)
+				return false;
+		}
+		return true;
+	}
+	return plug.asFloat(&status) == values[0] && status == MStatus::kSuccess;
 }
 
-MStatus ExecuteFloatParamSet(MString& mayaName, const std::string& paramName, float val)
+static bool HasIndex(const MIntArray& indices, unsigned int index)
 {
-	//setAttr "mlsLayerMetal1.kappa" 1.977012;
-	MString cmd = "setAttr \"" + mayaName + "." + MString(paramName.c_str()) + MString("\" ") + val;
-
-	LAYERSTACK_CMD_LOG(cmd);
-	return MGlobal::executeCommand(cmd);
+	for (unsigned int i = 0; i < indices.length(); ++i)
+	{
+		if (indices[i] == (int)index)
+			return true;
+	}
+	return false;
 }
 
 MString GetNodeTypeOutputParamName(NodeType t)
@@ -167,14 +201,19 @@ NodeType GetNodeTypeFromString(const std::string& str)
 	}
 }
 
-MStatus LinkNodes(LayeredMaterialNode& parent, LayeredMaterialNode& child, NodeChildIndex childIndex)
+MStatus LinkNodes(LayeredMaterialNode& parent, LayeredMaterialNode& child, NodeChildIndex childIndex, MDGModifier& dgMod)
 {
-	MString cmd = "connectAttr -f " +
-		child.mInstanceName + "." + GetNodeTypeOutputParamName(child.mType) + " " +
-		parent.mInstanceName + "." + GetNodeTypeInputParamName(parent.mType, childIndex);
+	MStatus status;
+	MPlug src = FindPlug(child.mObject, GetNodeTypeOutputParamName(child.mType), &status);
+	if (status != MStatus::kSuccess)
+		return status;
 
-	LAYERSTACK_CMD_LOG(cmd);
-	return MGlobal::executeCommand(cmd);
+	MPlug dst = FindPlug(parent.mObject, GetNodeTypeInputParamName(parent.mType, childIndex), &status);
+	if (status != MStatus::kSuccess)
+		return status;
+
+	LAYERSTACK_CMD_LOG("connectAttr " + src.name() + " " + dst.name());
+	return dgMod.connect(src, dst);
 }
 
 
@@ -185,6 +224,7 @@ LayeredMaterialNode::LayeredMaterialNode(NodeType t)
 	,	mChildrenCount(0)
 	,	mChildrenCapacity(0)
 	,	bCreated(false)
+	,	bFlattened(false)
 {
 }
 
@@ -192,7 +232,7 @@ LayeredMaterialNode::~LayeredMaterialNode()
 {
 }
 
-MStatus LayeredMaterialNode::Create(const char* pDesiredName)
+MStatus LayeredMaterialNode::Create(MDGModifier& dgMod, const char* pDesiredName)
 {
 	if (bCreated)
 	{
@@ -205,17 +245,21 @@ MStatus LayeredMaterialNode::Create(const char* pDesiredName)
 		mChildren = new LayeredMaterialNode* [mChildrenCapacity]();
 	}
 
-	MStatus success = ExecuteNodeCreation(mType, mInstanceName, pDesiredName);
+	MStatus success;
+	mObject = QueueNodeCreation(mType, dgMod, pDesiredName, &success);
+	mInstanceName = pDesiredName ? MString(pDesiredName) : GetNodeTypeName(mType);
+	mLayerName.clear();
+	bFlattened = false;
 	if (success != MStatus::kSuccess)
 	{
-		Delete();
+		Delete(dgMod);
 	}
 
 	bCreated = true;
 	return success;
 }
 
-MStatus LayeredMaterialNode::Delete()
+MStatus LayeredMaterialNode::Delete(MDGModifier& dgMod)
 {
 	if (mChildren)
 	{
@@ -224,7 +268,7 @@ MStatus LayeredMaterialNode::Delete()
 			LayeredMaterialNode* pChild = mChildren[i];
 			if (pChild)
 			{
-				pChild->Delete();
+				pChild->Delete(dgMod);
 				delete pChild;
 			}
 		}
@@ -235,12 +279,18 @@ MStatus LayeredMaterialNode::Delete()
 		mChildrenCount = 0;
 	}
 
-	MStatus success = ExecuteNodeDeletion(mInstanceName);
-	if (success != MStatus::kSuccess)
+	MStatus success = MStatus::kSuccess;
+	if (!mObject.isNull())
 	{
-		MGlobal::displayWarning("[LayerStack] WARNING: Failed to delete node: " + mInstanceName);
+		LAYERSTACK_CMD_LOG("delete " + mInstanceName);
+		success = dgMod.deleteNode(mObject);
+		if (success != MStatus::kSuccess)
+		{
+			MGlobal::displayWarning("[LayerStack] WARNING: Failed to delete node: " + mInstanceName);
+		}
 	}
 
+	mObject = MObject::kNullObj;
 	bCreated = false;
 	return success;
 }
@@ -251,8 +301,31 @@ void LayeredMaterialNode::Reset()
 	if (mType != NT_SURFACE)
 		return;
 
-	Delete();
-	Create();
+	// Deleted first, so the new node can take back its name
+	MDGModifier deleteMod;
+	Delete(deleteMod);
+	deleteMod.doIt();
+
+	MDGModifier createMod;
+	Create(createMod);
+	createMod.doIt();
+	UpdateNames();
+}
+
+void LayeredMaterialNode::UpdateNames()
+{
+	if (!mObject.isNull())
+	{
+		mInstanceName = MFnDependencyNode(mObject).name();
+	}
+
+	for (size_t i = 0; i < mChildrenCapacity; ++i)
+	{
+		if (mChildren[i])
+		{
+			mChildren[i]->UpdateNames();
+		}
+	}
 }
 
 // Stolen from Maya Code, but added a custom log message
@@ -268,7 +341,7 @@ void LayeredMaterialNode::Reset()
 }
 
 // For convenience in initializing example materials.
-MStatus LayeredMaterialNode::InitDefaultMaterialTree()
+MStatus LayeredMaterialNode::InitDefaultMaterialTree(MDGModifier& dgMod)
 {
 	LayeredMaterialNode* addNode0		= new LayeredMaterialNode(NT_ADD);
 	LayeredMaterialNode* volumetricNode	= new LayeredMaterialNode(NT_VOLUMETRIC);
@@ -279,173 +352,360 @@ MStatus LayeredMaterialNode::InitDefaultMaterialTree()
 		MGlobal::displayError("[LayerStack] ERROR: Failed to allocate add, volumetric, or dielectric nodes.");
 	}
 
-	MStatus status = addNode0->Create();
+	MStatus status = addNode0->Create(dgMod);
 	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to create add");
 
-	status = dielectricNode->Create();
+	status = dielectricNode->Create(dgMod);
 	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to create dielectric node.");
 
-	status = volumetricNode->Create();
+	status = volumetricNode->Create(dgMod);
 	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to create volumetric node.");
 
-	status = SetChild(PARAM, addNode0);
+	status = SetChild(PARAM, addNode0, dgMod);
 	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to set add0 as child of surface");
 	
-	status = addNode0->SetChild(TOP_LAYER, dielectricNode);
+	status = addNode0->SetChild(TOP_LAYER, dielectricNode, dgMod);
 	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to set diel as child of add0");
 
-	status = addNode0->SetChild(BOTTOM_LAYER, volumetricNode);
+	status = addNode0->SetChild(BOTTOM_LAYER, volumetricNode, dgMod);
 	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(status, "Failed to set vol as child of add0");
 
 	return status;
 }
 
-MStatus LayeredMaterialNode::InitFromJSON(MString& jsonData, MString& desiredMaterialName)
+MStatus LayeredMaterialNode::InitFromIR(const MaterialIR& ir, int materialIndex, MDGModifier& dgMod, bool bFlatten)
 {
-	using json = nlohmann::json;
+	bFlattened = bFlatten;
+	if (bFlatten)
+	{
+		return InitLayerArraysFromIR(ir, materialIndex, dgMod);
+	}
 
-	MStatus status = MStatus::kSuccess;
-	
-	const char* jsonStr = jsonData.asChar();
-	const char* matNameStr = desiredMaterialName.asChar();
+	return InitChildrenFromIR(ir, materialIndex, ir.nodes[materialIndex].name, dgMod);
+}
 
-	json materialData;
-	
-	try
+MStatus LayeredMaterialNode::UpdateFromIR(const MaterialIR& ir, int materialIndex, MDGModifier& deleteMod, MDGModifier& dgMod, bool bFlatten)
+{
+	if (mType != NT_SURFACE || !bCreated || bFlatten != bFlattened)
 	{
-		materialData = json::parse(jsonStr);
+		return MStatus::kFailure;
 	}
-	catch (json::parse_error& e)
+
+	// Array elements are compared against the current plug values
+	if (bFlatten)
 	{
-		MGlobal::displayError("[LayerStack] JSON PARSE ERROR: " + MString(e.what()));
+		return InitLayerArraysFromIR(ir, materialIndex, dgMod);
 	}
-	
-	json::iterator it = materialData.begin();
-	bool found = false;
-	for (;it != materialData.end(); it++)
-	{
-		if (!it->is_object())
-			continue;
 
-		auto params = (*it)["params"];
-		auto nameParam  = params["name"];
-		if (!nameParam.is_string())
-			continue;
+	return UpdateChildrenFromIR(ir, materialIndex, ir.nodes[materialIndex].name, deleteMod, dgMod);
+}
 
-		std::string name = nameParam.get<std::string>();
-		if (name == matNameStr)
-		{
-			found = true;
-			break;
-		}
+MStatus LayeredMaterialNode::InitChildrenFromIR(const MaterialIR& ir, int nodeIndex, const std::string& rootMaterialName, MDGModifier& dgMod)
+{
+	// Can accept no children, early out.
+	if (mChildrenCapacity == 0)
+	{
+		return MStatus::kSuccess;
 	}
 
-	if (!found)
+	MStatus status;
+
+	const MaterialIRNode& irNode = ir.nodes[nodeIndex];
+	for (unsigned int i = 0; i < irNode.childCount; ++i)
 	{
-		MGlobal::displayError("[LayerStack] Failed to find material from jsonData");
-		return MStatus::kNotFound;
+		if (mChildrenCount >= GetChildCapacity())
+			break; // Can accept no more children
+
+		status = CreateChildFromIR((NodeChildIndex)mChildrenCount, ir, irNode.children[i], rootMaterialName, dgMod);
 	}
-	std::string rootMaterialName(matNameStr);
-	status = InitChildrenFromJSON(materialData, it.value(), rootMaterialName);
 
 	return status;
 }
 
-MStatus LayeredMaterialNode::InitChildrenFromJSON(nlohmann::json& jsonData, nlohmann::json& parent, const std::string& rootMaterialName)
+MStatus LayeredMaterialNode::CreateChildFromIR(NodeChildIndex index, const MaterialIR& ir, int childIndex, const std::string& rootMaterialName, MDGModifier& dgMod)
 {
-	using json = nlohmann::json;
+	MStatus status;
 
-	// Can accept no children, early out.
+	const MaterialIRNode& irChild = ir.nodes[childIndex];
+
+	LayeredMaterialNode* node = new LayeredMaterialNode(irChild.type);
+	if (!irChild.name.empty())
+	{
+		std::string desiredName = irChild.name;
+		desiredName.append("_");
+		desiredName.append(rootMaterialName);
+		status = node->Create(dgMod, desiredName.c_str());
+	}
+	else
+	{
+		status = node->Create(dgMod);
+	}
+
+	node->mLayerName = irChild.name;
+	if (irChild.hasParams)
+	{
+		status = node->SetParamsFromIR(ir, childIndex, dgMod);
+	}
+
+	status = SetChild(index, node, dgMod);
+	status = node->InitChildrenFromIR(ir, childIndex, rootMaterialName, dgMod);
+	return status;
+}
+
+MStatus LayeredMaterialNode::UpdateChildrenFromIR(const MaterialIR& ir, int nodeIndex, const std::string& rootMaterialName, MDGModifier& deleteMod, MDGModifier& dgMod)
+{
 	if (mChildrenCapacity == 0)
 	{
 		return MStatus::kSuccess;
 	}
 
-	MStatus status;
+	MStatus status = MStatus::kSuccess;
+	const MaterialIRNode& irNode = ir.nodes[nodeIndex];
 
-	auto children = parent["children"];
-	json::iterator it = children.begin();
+	size_t index = 0;
+	for (unsigned int i = 0; i < irNode.childCount; ++i)
+	{
+		if (index >= GetChildCapacity() || status != MStatus::kSuccess)
+			break;
+
+		const int childIndex = irNode.children[i];
+		const MaterialIRNode& irChild = ir.nodes[childIndex];
 
-	static const int MAX_ITER_COUNT = 3;
-	int counter = 0;
-	for (; it != children.end(); it++)
+		LayeredMaterialNode* pCurrChild = mChildren[index];
+		if (pCurrChild && pCurrChild->mType == irChild.type)
+		{
+			// Same node, patch its parameters and keep walking down
+			if (irChild.hasParams)
+			{
+				if (!irChild.name.empty() && irChild.name != pCurrChild->mLayerName)
+				{
+					const MString desiredName((irChild.name + "_" + rootMaterialName).c_str());
+					LAYERSTACK_CMD_LOG("rename " + pCurrChild->mInstanceName + " " + desiredName);
+					status = dgMod.renameNode(pCurrChild->mObject, desiredName);
+					pCurrChild->mLayerName = irChild.name;
+				}
+				if (status == MStatus::kSuccess)
+					status = pCurrChild->SetParamsFromIR(ir, childIndex, dgMod);
+			}
+			if (status == MStatus::kSuccess)
+				status = pCurrChild->UpdateChildrenFromIR(ir, childIndex, rootMaterialName, deleteMod, dgMod);
+		}
+		else
+		{
+			// The structure changed below this slot, rebuild the subtree
+			if (pCurrChild)
+			{
+				pCurrChild->Delete(deleteMod);
+				delete pCurrChild;
+				mChildren[index] = nullptr;
+				mChildrenCount--;
+			}
+			status = CreateChildFromIR((NodeChildIndex)index, ir, childIndex, rootMaterialName, dgMod);
+		}
+		++index;
+	}
+
+	// Layers removed from the JSON
+	for (; index < GetChildCapacity(); ++index)
 	{
-		if (counter++ > MAX_ITER_COUNT)
+		LayeredMaterialNode* pCurrChild = mChildren[index];
+		if (pCurrChild)
 		{
-			MGlobal::displayWarning("[LayerStack] Warning: Max iteration count exceeded when iterating through children. Force exiting...");
-			return MStatus::kFailure;
+			pCurrChild->Delete(deleteMod);
+			delete pCurrChild;
+			mChildren[index] = nullptr;
+			mChildrenCount--;
 		}
+	}
 
-		if (mChildrenCount >= GetChildCapacity())
-			break; // Can accept no more children
+	return status;
+}
 
-		if (!it->is_string())
-			continue;
-		
-		std::string json_name = it->get<std::string>();
-		auto child_node = jsonData[json_name];
-		std::string node_type = child_node["type"].get<std::string>();
-		NodeType type = GetNodeTypeFromString(node_type);
-
-		LayeredMaterialNode* node = new LayeredMaterialNode(type);
-		if (child_node.find("params") != child_node.end())
+static const MaterialIRParam* FindIRParam(const MaterialIR& ir, const MaterialIRNode& node, const char* name)
+{
+	const MaterialIRParam* params = ir.GetParams(node);
+	for (unsigned int i = 0; i < node.paramCount; ++i)
+	{
+		if (params[i].name == name)
+			return &params[i];
+	}
+	return nullptr;
+}
+
+static float GetIRFloat(const MaterialIR& ir, const MaterialIRNode& node, const char* name, float fallback)
+{
+	const MaterialIRParam* param = FindIRParam(ir, node, name);
+	return (param && param->size == 1) ? param->values[0] : fallback;
+}
+
+static void GetIRVec3(const MaterialIR& ir, const MaterialIRNode& node, const char* name, float* out)
+{
+	const MaterialIRParam* param = FindIRParam(ir, node, name);
+	if (!param || param->size != 3)
+		return;
+	std::copy(param->values, param->values + 3, out);
+}
+
+// Appends the leaf layers below node, top to bottom, following the same
+// children order as InitChildrenFromIR. Trees are validated by CompileMaterialIR.
+static bool CollectFlatLayers(const MaterialIR& ir, int nodeIndex, std::vector<FlatLayer>& outLayers)
+{
+	const MaterialIRNode& node = ir.nodes[nodeIndex];
+
+	FlatLayer layer;
+	switch (node.type)
+	{
+	case NT_SURFACE:
+	case NT_ADD:
+		for (unsigned int i = 0; i < node.childCount; ++i)
 		{
-			std::string desiredName = (child_node["params"]["name"]).get<std::string>();
-			desiredName.append("_");
-			desiredName.append(rootMaterialName);
-			status = node->Create(desiredName.c_str());
-			status = node->SetParamsFromJSON(child_node["params"]);
+			if (!CollectFlatLayers(ir, node.children[i], outLayers))
+				return false;
 		}
-		else
+		return true;
+	case NT_METAL:
+		layer.albedo[1] = layer.albedo[2] = 0.7f;
+		GetIRVec3(ir, node, "albedo", layer.albedo);
+		layer.eta = GetIRFloat(ir, node, "IOR", 0.5f);
+		layer.kappa = GetIRFloat(ir, node, "kappa", 3.0f);
+		layer.roughness = GetIRFloat(ir, node, "roughness", 0.2f);
+		break;
+	case NT_DIELECTRIC:
+		layer.eta = GetIRFloat(ir, node, "IOR", 1.5f);
+		layer.roughness = GetIRFloat(ir, node, "roughness", 0.01f);
+		break;
+	case NT_VOLUMETRIC:
+		layer.albedo[0] = 0.0f;
+		layer.albedo[1] = 0.62f;
+		GetIRVec3(ir, node, "albedo", layer.albedo);
+		layer.depth = GetIRFloat(ir, node, "depth", 0.1f);
+		layer.g = GetIRFloat(ir, node, "g", 0.7f);
+		break;
+	default:
+		return false;
+	}
+
+	outLayers.push_back(layer);
+	return true;
+}
+
+MStatus LayeredMaterialNode::InitLayerArraysFromIR(const MaterialIR& ir, int nodeIndex, MDGModifier& dgMod)
+{
+	if (mType != NT_SURFACE)
+		return MStatus::kFailure;
+
+	std::vector<FlatLayer> layers;
+	if (!CollectFlatLayers(ir, nodeIndex, layers))
+	{
+		MGlobal::displayError("[LayerStack] ERROR: Unsupported node in the material tree, can't flatten " + mInstanceName);
+		return MStatus::kFailure;
+	}
+
+	MStatus status, plugStatus = MStatus::kSuccess;
+	MPlug albedoPlug = FindPlug(mObject, "layerAlbedo", &status);
+	plugStatus = status ? plugStatus : status;
+	MPlug etaPlug = FindPlug(mObject, "layerEta", &status);
+	plugStatus = status ? plugStatus : status;
+	MPlug kappaPlug = FindPlug(mObject, "layerKappa", &status);
+	plugStatus = status ? plugStatus : status;
+	MPlug roughnessPlug = FindPlug(mObject, "layerRoughness", &status);
+	plugStatus = status ? plugStatus : status;
+	MPlug depthPlug = FindPlug(mObject, "layerDepth", &status);
+	plugStatus = status ? plugStatus : status;
+	MPlug gPlug = FindPlug(mObject, "layerG", &status);
+	plugStatus = status ? plugStatus : status;
+	LAYERSTACK_CHECK_STATUS_LOG_AND_RETURN(plugStatus, "[LayerStack] ERROR: " + mInstanceName + " has no layer array attributes");
+	status = MStatus::kSuccess;
+
+	// Elements already holding the wanted values are skipped. Missing ones
+	// are always set, so every array gets one element per layer.
+	MPlug arrayPlugs[] = { albedoPlug, etaPlug, kappaPlug, roughnessPlug, depthPlug, gPlug };
+	MIntArray existing[6];
+	for (unsigned int a = 0; a < 6; ++a)
+		arrayPlugs[a].getExistingArrayAttributeIndices(existing[a]);
+
+	const auto setElement = [&](unsigned int a, unsigned int i, const float* values, unsigned int size) -> MStatus
+	{
+		MPlug element = arrayPlugs[a].elementByLogicalIndex(i);
+		if (HasIndex(existing[a], i) && PlugHasValues(element, values, size))
+			return MStatus::kSuccess;
+		return size == 3
+			? QueueVec3ParamSet(dgMod, element, values[0], values[1], values[2])
+			: QueueFloatParamSet(dgMod, element, values[0]);
+	};
+
+	for (unsigned int i = 0; i < (unsigned int)layers.size() && status == MStatus::kSuccess; ++i)
+	{
+		const FlatLayer& layer = layers[i];
+		status = setElement(0, i, layer.albedo, 3);
+		if (status == MStatus::kSuccess)
+			status = setElement(1, i, &layer.eta, 1);
+		if (status == MStatus::kSuccess)
+			status = setElement(2, i, &layer.kappa, 1);
+		if (status == MStatus::kSuccess)
+			status = setElement(3, i, &layer.roughness, 1);
+		if (status == MStatus::kSuccess)
+			status = setElement(4, i, &layer.depth, 1);
+		if (status == MStatus::kSuccess)
+			status = setElement(5, i, &layer.g, 1);
+	}
+
+	// Elements past the last layer, left by a previous apply or by hand
+	for (unsigned int a = 0; a < 6 && status == MStatus::kSuccess; ++a)
+	{
+		for (unsigned int e = 0; e < existing[a].length(); ++e)
 		{
-			status = node->Create();
+			if (existing[a][e] < (int)layers.size())
+				continue;
+
+			MPlug element = arrayPlugs[a].elementByLogicalIndex((unsigned int)existing[a][e]);
+			LAYERSTACK_CMD_LOG("removeMultiInstance " + element.name());
+			status = dgMod.removeMultiInstance(element, true);
+			if (status != MStatus::kSuccess)
+				break;
 		}
-			
-		status = SetChild((NodeChildIndex)mChildrenCount, node);
-		status = node->InitChildrenFromJSON(jsonData, child_node, rootMaterialName);
 	}
 
 	return status;
 }
 
-MStatus LayeredMaterialNode::SetParamsFromJSON(nlohmann::json& paramsStruct)
+MStatus LayeredMaterialNode::SetParamsFromIR(const MaterialIR& ir, int nodeIndex, MDGModifier& dgMod)
 {
-	using json = nlohmann::json;
-
 	MStatus status = MStatus::kSuccess;
-	json::iterator it = paramsStruct.begin();
 
-	static const int MAX_PARAM_COUNT = 10;
-	int counter = 0;
-	for (; it != paramsStruct.end(); ++it)
+	const MaterialIRNode& irNode = ir.nodes[nodeIndex];
+	const MaterialIRParam* params = ir.GetParams(irNode);
+	for (unsigned int i = 0; i < irNode.paramCount; ++i)
 	{
-		if (counter++ > MAX_PARAM_COUNT)
+		const MaterialIRParam& param = params[i];
+
+		MStatus plugStatus;
+		MPlug plug = FindPlug(mObject, MString(param.name.c_str()), &plugStatus);
+		if (plugStatus != MStatus::kSuccess)
 		{
-			MGlobal::displayWarning("[LayerStack] Warning: Max iteration count exceeded when setting params. Force exiting...");
-			return MStatus::kFailure;
+			MGlobal::displayWarning("[LayerStack] Warning: " + GetNodeTypeName(mType) + " has no attribute " + MString(param.name.c_str()));
+			continue;
 		}
 
-		const std::string& paramName = it.key(); // param name
-		json& paramValue = it.value();
-
-		if (paramValue.is_array()) // Assume vec3
+		if (PlugHasValues(plug, param.values, param.size))
 		{
-			ExecuteVec3ParamSet(mInstanceName, paramName, paramValue);
+			continue; // Already set in the scene
 		}
-		else if (paramValue.is_number()) // Assume float
+
+		if (param.size == 3)
 		{
-			ExecuteFloatParamSet(mInstanceName, paramName, paramValue.get<float>());
+			QueueVec3ParamSet(dgMod, plug, param.values[0], param.values[1], param.values[2]);
 		}
 		else
 		{
-			continue; // Names and such are handled at creation time
+			QueueFloatParamSet(dgMod, plug, param.values[0]);
 		}
 	}
 
 	return status;
 }
 
-MStatus LayeredMaterialNode::SetChild(NodeChildIndex index, LayeredMaterialNode* pChild)
+MStatus LayeredMaterialNode::SetChild(NodeChildIndex index, LayeredMaterialNode* pChild, MDGModifier& dgMod)
 {
 	if (mChildren == nullptr)
 	{
@@ -464,7 +724,7 @@ MStatus LayeredMaterialNode::SetChild(NodeChildIndex index, LayeredMaterialNode*
 	MStatus ret = MStatus::kSuccess;
 	if (pChild)
 	{
-		ret = LinkNodes(*this, *pChild, index);
+		ret = LinkNodes(*this, *pChild, index, dgMod);
 	}
 
 	mChildren[index] = pChild;
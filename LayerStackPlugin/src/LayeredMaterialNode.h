@@ -1,22 +1,15 @@
 #pragma once
 
+#include <maya/MDGModifier.h>
 #include <maya/MGlobal.h>
+#include <maya/MObject.h>
 #include <maya/MString.h>
 #include <maya/MStatus.h>
 
+#include <string>
 #include <vector>
-#include "external/nlohmann/json.hpp"
 
-enum NodeType
-{
-	NT_INVALID = -1,
-	NT_SURFACE = 0,
-	NT_ADD,
-	NT_VOLUMETRIC,
-	NT_DIELECTRIC,
-	NT_METAL,
-	NT_COUNT
-};
+#include "MaterialIR.h"
 
 enum NodeChildIndex
 {
@@ -26,33 +19,69 @@ enum NodeChildIndex
 };
 
 MString GetNodeTypeName(NodeType t);
-MStatus ExecuteNodeCreation(NodeType t, MString& outName, const char* pDesiredName = nullptr);
+// Queues the creation of a node on dgMod. Its name is final once dgMod.doIt() ran.
+MObject QueueNodeCreation(NodeType t, MDGModifier& dgMod, const char* pDesiredName = nullptr, MStatus* pStatus = nullptr);
 MString GetNodeTypeOutputParamName(NodeType t);
 size_t GetNodeTypeChildCount(NodeType t);
+NodeType GetNodeTypeFromString(const std::string& str);
+
+// One layer of a flattened stack. Defaults match the layer node attributes.
+struct FlatLayer
+{
+	float albedo[3] = { 1.0f, 1.0f, 1.0f };
+	float eta = 1.0f;
+	float kappa = 0.0f;
+	float roughness = 0.0f;
+	float depth = 0.0f;
+	float g = 0.0f;
+};
 
 struct LayeredMaterialNode
 {
 	LayeredMaterialNode(NodeType t);
 	~LayeredMaterialNode();
 
-	MStatus Create(const char* pDesiredName = nullptr);
-	MStatus Delete();
+	// Node creation, attribute sets and connections are queued on dgMod, so a
+	// whole material is built by a single dgMod.doIt().
+	MStatus Create(MDGModifier& dgMod, const char* pDesiredName = nullptr);
+	MStatus Delete(MDGModifier& dgMod);
 	void Reset();
 
-	MStatus InitDefaultMaterialTree();
-	MStatus InitFromJSON(MString& jsonData, MString& desiredMaterialName);
-	MStatus InitChildrenFromJSON(nlohmann::json& jsonData, nlohmann::json& parent, const std::string& rootMaterialName);
-	MStatus SetChild(NodeChildIndex index, LayeredMaterialNode* pChild);
-	MStatus SetParamsFromJSON(nlohmann::json& paramsStruct);
+	// Refreshes mInstanceName of this node and its children, once the
+	// modifier that created them ran.
+	void UpdateNames();
+
+	MStatus InitDefaultMaterialTree(MDGModifier& dgMod);
+	// Builds the material at materialIndex in ir below this surface. With
+	// bFlatten, the layers are set on the array attributes of this surface
+	// instead of being created as a network of layer nodes.
+	MStatus InitFromIR(const MaterialIR& ir, int materialIndex, MDGModifier& dgMod, bool bFlatten = false);
+	MStatus InitChildrenFromIR(const MaterialIR& ir, int nodeIndex, const std::string& rootMaterialName, MDGModifier& dgMod);
+	MStatus InitLayerArraysFromIR(const MaterialIR& ir, int nodeIndex, MDGModifier& dgMod);
+	MStatus CreateChildFromIR(NodeChildIndex index, const MaterialIR& ir, int childIndex, const std::string& rootMaterialName, MDGModifier& dgMod);
+
+	// Brings an applied material to the latest JSON in place. Only changed
+	// parameters are set, and only the subtrees whose node types changed are
+	// rebuilt. Deletions are queued on deleteMod, which must run before dgMod.
+	// Fails when the material can't be patched, e.g. when switching to or
+	// from a flattened stack; the caller then rebuilds it.
+	MStatus UpdateFromIR(const MaterialIR& ir, int materialIndex, MDGModifier& deleteMod, MDGModifier& dgMod, bool bFlatten = false);
+	MStatus UpdateChildrenFromIR(const MaterialIR& ir, int nodeIndex, const std::string& rootMaterialName, MDGModifier& deleteMod, MDGModifier& dgMod);
+
+	MStatus SetChild(NodeChildIndex index, LayeredMaterialNode* pChild, MDGModifier& dgMod);
+	MStatus SetParamsFromIR(const MaterialIR& ir, int nodeIndex, MDGModifier& dgMod);
 
 	size_t GetChildCapacity() const { return mChildrenCapacity; }
 
 	LayeredMaterialNode** mChildren;
+	MObject mObject;
 	MString mInstanceName;
+	std::string mLayerName;
 	NodeType mType;
 	size_t mChildrenCount;
 	size_t mChildrenCapacity;
 	bool bCreated;
+	bool bFlattened;
 };
 
-MStatus LinkNodes(LayeredMaterialNode& parent, LayeredMaterialNode& child, NodeChildIndex childIndex);
\ No newline at end of file
+MStatus LinkNodes(LayeredMaterialNode& parent, LayeredMaterialNode& child, NodeChildIndex childIndex, MDGModifier& dgMod);
\ No newline at end of file
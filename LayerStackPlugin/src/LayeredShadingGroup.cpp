@@ -3,6 +3,10 @@
 
 #include <maya/MString.h>
 #include <maya/MGlobal.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MFnSet.h>
+#include <maya/MPlug.h>
+#include <maya/MSelectionList.h>
 
 //static const MString LAYER_STACK_GROUP_NAME = "LayerStackShadingGroup";
 
@@ -12,21 +16,31 @@ MStatus LayeredShadingGroup::Create(MString& materialName)
 
 	MString desiredName = materialName + "_ShadingGroup";
 
-	MString cmd = "sets -renderable true -noSurfaceShader true -empty -name " + desiredName + ";";
-	status = MGlobal::executeCommand(cmd, mName);
+	// Same as "sets -renderable true -noSurfaceShader true -empty", a renderable
+	// set is a shading engine
+	MSelectionList emptyList;
+	MFnSet setFn;
+	mObject = setFn.create(emptyList, MFnSet::kRenderableOnly, &status);
+	if (status != MStatus::kSuccess)
+	{
+		MGlobal::displayError("[LayerStack] ERROR: Failed to create shading group " + desiredName);
+		return status;
+	}
+
+	mName = setFn.setName(desiredName, false, &status);
 	MGlobal::displayInfo("[LayerStack] Result: " + mName);
 
 	return status;
 }
 
-MStatus LayeredShadingGroup::AssignMaterial(LayeredMaterialNode* pRoot, MString& materialName)
+MStatus LayeredShadingGroup::AssignMaterial(LayeredMaterialNode* pRoot, MString& materialName, MDGModifier& dgMod)
 {
 	MStatus status;
 	if (!pRoot)
 	{
 		// Create and initialize it if null is passed in.
 		pRoot = new LayeredMaterialNode(NT_SURFACE);
-		status = pRoot->Create(materialName.asChar());
+		status = pRoot->Create(dgMod, materialName.asChar());
 		if (status != MStatus::kSuccess)
 		{
 			MGlobal::displayInfo("Failed to create root surface shader.");
@@ -34,9 +48,15 @@ MStatus LayeredShadingGroup::AssignMaterial(LayeredMaterialNode* pRoot, MString&
 		}
 	}
 
-	MString cmd = "connectAttr -f " + pRoot->mInstanceName + ".outColor " + mName + ".surfaceShader";
-	status = MGlobal::executeCommand(cmd);
-
 	mMaterialRoot = pRoot;
-	return status;
+
+	MPlug outColor = MFnDependencyNode(pRoot->mObject).findPlug("outColor", true, &status);
+	if (status != MStatus::kSuccess)
+		return status;
+
+	MPlug surfaceShader = MFnDependencyNode(mObject).findPlug("surfaceShader", true, &status);
+	if (status != MStatus::kSuccess)
+		return status;
+
+	return dgMod.connect(outColor, surfaceShader);
 }
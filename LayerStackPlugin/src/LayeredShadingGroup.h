@@ -1,16 +1,28 @@
 #pragma once
 
+#include <maya/MDGModifier.h>
 #include <maya/MObject.h>
 #include <maya/MStatus.h>
 #include <maya/MString.h>
 
+#include <cstdint>
+#include <string>
+
 struct LayeredMaterialNode;
 
 struct LayeredShadingGroup
 {
 	MStatus Create(MString& materialName);
-	MStatus AssignMaterial(LayeredMaterialNode* pRoot, MString& materialName);
+	// Creation of a new root and its connection are queued on dgMod
+	MStatus AssignMaterial(LayeredMaterialNode* pRoot, MString& materialName, MDGModifier& dgMod);
 
 	LayeredMaterialNode* mMaterialRoot = nullptr;
+	MObject mObject;
 	MString mName;
+
+	// Content of the applied material (see MaterialIRContent), its hash and
+	// the number of material names sharing this group, kept by the MaterialRegistry
+	uint64_t mContentHash = 0;
+	std::string mContent;
+	unsigned int mNameCount = 0;
 };
\ No newline at end of file
@@ -0,0 +1,213 @@
+#include "MaterialIR.h"
+#include "LayeredMaterialNode.h"
+
+#include <maya/MGlobal.h>
+#include <maya/MString.h>
+
+#include <algorithm>
+
+#include "external/nlohmann/json.hpp"
+
+bool MaterialIRParam::operator==(const MaterialIRParam& other) const
+{
+	if (name != other.name || size != other.size)
+		return false;
+
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		if (values[i] != other.values[i])
+			return false;
+	}
+	return true;
+}
+
+int MaterialIR::FindMaterial(const std::string& name) const
+{
+	auto it = materials.find(name);
+	return it != materials.end() ? it->second : -1;
+}
+
+// Rejects unknown node types, cycles and trees deeper than a material can
+// reasonably be. Heights are memoized, so shared nodes are visited once.
+static const int TREE_UNVISITED = -1;
+static const int TREE_VISITING = -2;
+static bool IsValidTree(const MaterialIR& ir, int index, std::vector<int>& heights, int depth = 0)
+{
+	static const int MAX_DEPTH = 64;
+	if (heights[index] == TREE_VISITING)
+		return false;
+	if (heights[index] != TREE_UNVISITED)
+		return depth + heights[index] <= MAX_DEPTH;
+	const MaterialIRNode& node = ir.nodes[index];
+	if (depth > MAX_DEPTH || node.type == NT_INVALID)
+		return false;
+
+	heights[index] = TREE_VISITING;
+	int height = 0;
+	for (unsigned int i = 0; i < node.childCount; ++i)
+	{
+		if (!IsValidTree(ir, node.children[i], heights, depth + 1))
+		{
+			heights[index] = TREE_UNVISITED;
+			return false;
+		}
+		height = std::max(height, heights[node.children[i]] + 1);
+	}
+	heights[index] = height;
+	return true;
+}
+
+static void ReportMessage(const std::string& message, bool bError, std::vector<std::string>* pOutMessages)
+{
+	if (pOutMessages)
+	{
+		pOutMessages->push_back(message);
+	}
+	else if (bError)
+	{
+		MGlobal::displayError(MString(message.c_str()));
+	}
+	else
+	{
+		MGlobal::displayWarning(MString(message.c_str()));
+	}
+}
+
+static void CompileParams(const nlohmann::json& params, MaterialIRNode& node, std::vector<MaterialIRParam>& outParams)
+{
+	node.hasParams = true;
+	node.firstParam = (unsigned int)outParams.size();
+
+	for (auto it = params.begin(); it != params.end(); ++it)
+	{
+		const nlohmann::json& value = it.value();
+		if (it.key() == "name")
+		{
+			if (value.is_string())
+				node.name = value.get<std::string>();
+			continue;
+		}
+
+		MaterialIRParam param;
+		param.name = it.key();
+		if (value.is_number())
+		{
+			param.values[0] = value.get<float>();
+		}
+		else if (value.is_array() && value.size() == 3 && value[0].is_number() && value[1].is_number() && value[2].is_number())
+		{
+			param.size = 3;
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				param.values[i] = value[i].get<float>();
+			}
+		}
+		else
+		{
+			continue; // Not an attribute value
+		}
+		outParams.push_back(param);
+	}
+
+	node.paramCount = (unsigned int)outParams.size() - node.firstParam;
+}
+
+MStatus CompileMaterialIR(const char* jsonStr, MaterialIR& outIR, std::vector<std::string>* pOutMessages)
+{
+	using json = nlohmann::json;
+
+	outIR.nodes.clear();
+	outIR.params.clear();
+	outIR.materials.clear();
+
+	json materialData;
+	try
+	{
+		materialData = json::parse(jsonStr);
+	}
+	catch (json::parse_error& e)
+	{
+		ReportMessage(std::string("[LayerStack] JSON PARSE ERROR: ") + e.what(), true, pOutMessages);
+		return MStatus::kFailure;
+	}
+
+	if (!materialData.is_object())
+	{
+		ReportMessage("[LayerStack] ERROR: The material json is not an object", true, pOutMessages);
+		return MStatus::kFailure;
+	}
+
+	// Nodes get their index first, so children can be resolved in the same pass
+	std::unordered_map<std::string, int> nodeIndices;
+	nodeIndices.reserve(materialData.size());
+	for (auto it = materialData.begin(); it != materialData.end(); ++it)
+	{
+		if (it->is_object())
+		{
+			nodeIndices.emplace(it.key(), (int)nodeIndices.size());
+		}
+	}
+	outIR.nodes.resize(nodeIndices.size());
+
+	int index = 0;
+	for (auto it = materialData.begin(); it != materialData.end(); ++it)
+	{
+		if (!it->is_object())
+			continue;
+
+		const json& entry = it.value();
+		MaterialIRNode& node = outIR.nodes[index];
+
+		auto type = entry.find("type");
+		node.type = (type != entry.end() && type->is_string()) ? GetNodeTypeFromString(type->get<std::string>()) : NT_INVALID;
+
+		auto params = entry.find("params");
+		if (params != entry.end() && params->is_object())
+		{
+			CompileParams(*params, node, outIR.params);
+		}
+
+		// Children past the capacity of the node type are ignored, like the layer nodes do
+		auto children = entry.find("children");
+		if (children != entry.end() && children->is_array())
+		{
+			const size_t capacity = GetNodeTypeChildCount(node.type);
+			for (const json& child : *children)
+			{
+				if (node.childCount >= capacity)
+					break;
+				if (!child.is_string())
+					continue;
+
+				auto childIndex = nodeIndices.find(child.get<std::string>());
+				if (childIndex == nodeIndices.end())
+				{
+					ReportMessage("[LayerStack] Warning: " + it.key() + " has a missing child " + child.get<std::string>(), false, pOutMessages);
+					continue;
+				}
+				node.children[node.childCount++] = childIndex->second;
+			}
+		}
+
+		if (node.type == NT_SURFACE && !node.name.empty())
+		{
+			outIR.materials.emplace(node.name, index);
+		}
+		++index;
+	}
+
+	std::vector<int> heights(outIR.nodes.size(), TREE_UNVISITED);
+	for (auto it = outIR.materials.begin(); it != outIR.materials.end();)
+	{
+		if (IsValidTree(outIR, it->second, heights))
+		{
+			++it;
+			continue;
+		}
+
+		ReportMessage("[LayerStack] Warning: " + it->first + " has an unknown layer type, a cycle or a too deep layer tree, ignored", false, pOutMessages);
+		it = outIR.materials.erase(it);
+	}
+
+	return MStatus::kSuccess;
+}
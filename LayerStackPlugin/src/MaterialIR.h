@@ -0,0 +1,64 @@
+#pragma once
+
+#include <maya/MStatus.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum NodeType
+{
+	NT_INVALID = -1,
+	NT_SURFACE = 0,
+	NT_ADD,
+	NT_VOLUMETRIC,
+	NT_DIELECTRIC,
+	NT_METAL,
+	NT_COUNT
+};
+
+// A float or color parameter of a node
+struct MaterialIRParam
+{
+	std::string name;
+	unsigned int size = 1; // 1 or 3
+	float values[3] = { 0.0f, 0.0f, 0.0f };
+
+	bool operator==(const MaterialIRParam& other) const;
+	bool operator!=(const MaterialIRParam& other) const { return !(*this == other); }
+};
+
+struct MaterialIRNode
+{
+	static const unsigned int MAX_CHILDREN = 2;
+
+	NodeType type = NT_INVALID;
+	// The "name" param. Nodes without params get the default Maya name.
+	std::string name;
+	bool hasParams = false;
+	// Range in MaterialIR::params
+	unsigned int firstParam = 0;
+	unsigned int paramCount = 0;
+	// Indices in MaterialIR::nodes, top to bottom
+	int children[MAX_CHILDREN] = { -1, -1 };
+	unsigned int childCount = 0;
+};
+
+// The material JSON compiled in one pass. Nodes are stored flat and refer to
+// their params and children by index, so building a material doesn't touch
+// the JSON again.
+struct MaterialIR
+{
+	std::vector<MaterialIRNode> nodes;
+	std::vector<MaterialIRParam> params;
+	// Surface nodes by material name
+	std::unordered_map<std::string, int> materials;
+
+	// Index of the surface node of the material, -1 when it isn't there
+	int FindMaterial(const std::string& name) const;
+	const MaterialIRParam* GetParams(const MaterialIRNode& node) const { return params.data() + node.firstParam; }
+};
+
+// Errors and warnings are displayed, or appended to pOutMessages when given.
+// With pOutMessages, no Maya API is used and it can run on any thread.
+MStatus CompileMaterialIR(const char* jsonStr, MaterialIR& outIR, std::vector<std::string>* pOutMessages = nullptr);
@@ -0,0 +1,134 @@
+#include "MaterialRegistry.h"
+#include "LayeredShadingGroup.h"
+#include "MaterialIR.h"
+
+#include <algorithm>
+
+template<typename T>
+static void AppendValue(const T& value, std::string& content)
+{
+	content.append((const char*)&value, sizeof(T));
+}
+
+// Node types, params in key order and children, without the names
+static void AppendMaterialNode(const MaterialIR& ir, int nodeIndex, std::string& content)
+{
+	const MaterialIRNode& node = ir.nodes[nodeIndex];
+	AppendValue((int)node.type, content);
+
+	const MaterialIRParam* params = ir.GetParams(node);
+	AppendValue(node.paramCount, content);
+	for (unsigned int i = 0; i < node.paramCount; ++i)
+	{
+		content.append(params[i].name.c_str(), params[i].name.size() + 1);
+		content.append((const char*)params[i].values, params[i].size * sizeof(float));
+	}
+
+	AppendValue(node.childCount, content);
+	for (unsigned int i = 0; i < node.childCount; ++i)
+	{
+		AppendMaterialNode(ir, node.children[i], content);
+	}
+}
+
+std::string MaterialIRContent(const MaterialIR& ir, int materialIndex, bool bFlatten)
+{
+	// A flattened material is a different network
+	std::string content;
+	AppendValue(bFlatten, content);
+	AppendMaterialNode(ir, materialIndex, content);
+	return content;
+}
+
+uint64_t HashMaterialContent(const std::string& content)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char byte : content)
+	{
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+MaterialRegistry::~MaterialRegistry()
+{
+	Clear();
+}
+
+LayeredShadingGroup* MaterialRegistry::FindByName(const std::string& name) const
+{
+	auto it = mByName.find(name);
+	return it != mByName.end() ? it->second : nullptr;
+}
+
+LayeredShadingGroup* MaterialRegistry::FindByContent(uint64_t hash, const std::string& content) const
+{
+	auto it = mByHash.find(hash);
+	return it != mByHash.end() && it->second->mContent == content ? it->second : nullptr;
+}
+
+void MaterialRegistry::Add(LayeredShadingGroup* group)
+{
+	mGroups.push_back(group);
+}
+
+void MaterialRegistry::Bind(const std::string& name, LayeredShadingGroup* group)
+{
+	Unbind(name);
+	mByName[name] = group;
+	group->mNameCount++;
+}
+
+void MaterialRegistry::Unbind(const std::string& name)
+{
+	// The group stays registered by hash, identical materials can still use it
+	auto it = mByName.find(name);
+	if (it == mByName.end())
+		return;
+
+	it->second->mNameCount--;
+	mByName.erase(it);
+}
+
+void MaterialRegistry::Rehash(LayeredShadingGroup* group, uint64_t hash, const std::string& content)
+{
+	auto it = mByHash.find(group->mContentHash);
+	if (it != mByHash.end() && it->second == group)
+	{
+		mByHash.erase(it);
+	}
+
+	// When another group already has this hash, it stays the shared one
+	group->mContentHash = hash;
+	group->mContent = content;
+	mByHash.emplace(hash, group);
+}
+
+void MaterialRegistry::Remove(LayeredShadingGroup* group)
+{
+	auto it = mByHash.find(group->mContentHash);
+	if (it != mByHash.end() && it->second == group)
+	{
+		mByHash.erase(it);
+	}
+
+	for (auto name = mByName.begin(); name != mByName.end();)
+	{
+		name = name->second == group ? mByName.erase(name) : std::next(name);
+	}
+
+	mGroups.erase(std::remove(mGroups.begin(), mGroups.end(), group), mGroups.end());
+	delete group;
+}
+
+void MaterialRegistry::Clear()
+{
+	for (LayeredShadingGroup* group : mGroups)
+	{
+		delete group;
+	}
+	mGroups.clear();
+	mByName.clear();
+	mByHash.clear();
+}
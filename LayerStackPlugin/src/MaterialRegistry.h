@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LayeredShadingGroup;
+struct MaterialIR;
+
+// Content of the material at materialIndex in ir, as bytes to hash and
+// compare. Layer names don't take part, so materials with the same layers
+// and parameters have the same content.
+std::string MaterialIRContent(const MaterialIR& ir, int materialIndex, bool bFlatten);
+
+// FNV-1a of a material content, stable across sessions unlike std::hash
+uint64_t HashMaterialContent(const std::string& content);
+
+// Shading groups created by the plugin, found by material name or content hash.
+// Several material names can share one group when their content is the same.
+// The registry owns the groups.
+class MaterialRegistry
+{
+public:
+	~MaterialRegistry();
+
+	LayeredShadingGroup* FindByName(const std::string& name) const;
+	// The group with this content. The hash only finds it, the content is
+	// compared so that a hash collision never shares a group.
+	LayeredShadingGroup* FindByContent(uint64_t hash, const std::string& content) const;
+
+	// Takes ownership of a new group. It's found by hash once Rehash() gave
+	// it the hash of its built material.
+	void Add(LayeredShadingGroup* group);
+	// Binds the material name to group, releasing the group it used before
+	void Bind(const std::string& name, LayeredShadingGroup* group);
+	void Unbind(const std::string& name);
+	// Moves group to a new content after its material was edited
+	void Rehash(LayeredShadingGroup* group, uint64_t hash, const std::string& content);
+	// Deletes a group, unbinding the material names still bound to it
+	void Remove(LayeredShadingGroup* group);
+
+	void Clear();
+
+private:
+	std::unordered_map<std::string, LayeredShadingGroup*> mByName;
+	std::unordered_map<uint64_t, LayeredShadingGroup*> mByHash;
+	std::vector<LayeredShadingGroup*> mGroups;
+};
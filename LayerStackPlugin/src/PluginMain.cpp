@@ -4,6 +4,7 @@
 #include <maya/MGlobal.h>
 
 #include "LayerStackCmd.h"
+#include "LayerStackImportCmd.h"
 
 #define LAYERSTACK_NAME_STR "LayerStack"
 #define LAYERSTACK_MENU_STR "LayerStackMenu"
@@ -46,6 +47,12 @@ MStatus initializePlugin( MObject obj )
         return status;
     }
 
+    status = plugin.registerCommand( LayerStackImportCmd::name(), LayerStackImportCmd::creator);
+    if (!status) {
+        status.perror("registerCommand");
+        return status;
+    }
+
     // Load python scripts
     MString pluginPath = plugin.loadPath() + "/../scripts";
 
@@ -81,6 +88,12 @@ MStatus uninitializePlugin( MObject obj)
 	    return status;
     }
 
+    status = plugin.deregisterCommand( LayerStackImportCmd::name() );
+    if (!status) {
+	    status.perror("deregisterCommand");
+	    return status;
+    }
+
     return status;
 }
 
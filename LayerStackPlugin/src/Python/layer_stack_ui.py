@@ -3,11 +3,80 @@ import maya.mel as mel
 import json
 import os
 import glob
+import shutil
+import subprocess
+import threading
+import maya.utils
 
 # Global variables to track the layer structure
 layer_tree = {"root": {"type": "root", "children": []}}
 layer_counter = 0
 selected_param_layer = None  # Track which parameter layer is currently being edited
+swatch_generation = 0  # Bumped on every preset refresh, stale swatch renders are dropped
+
+def find_swatch_tool(plugin_dir):
+    """mls_swatch from MLS_SWATCH_TOOL, next to the plugin or on the PATH"""
+    tool = os.environ.get("MLS_SWATCH_TOOL")
+    if tool and os.path.isfile(tool):
+        return tool
+    for name in ("mls_swatch.exe", "mls_swatch"):
+        tool = os.path.join(plugin_dir, name)
+        if os.path.isfile(tool):
+            return tool
+    return shutil.which("mls_swatch")
+
+def render_preset_swatches(tool, preset_dir, cache_dir):
+    """Swatch image path by preset name, and the summary line of the renderer.
+    Swatches are cached by material content, so only new or edited presets are rendered.
+    Runs outside the main thread, so it doesn't call any Maya command."""
+    result = subprocess.run([tool, "--presets", preset_dir, "--cache", cache_dir, "--size", "64"],
+                            capture_output=True, text=True, timeout=600)
+
+    swatches = {}
+    summary = {}
+    for line in result.stdout.splitlines():
+        try:
+            entry = json.loads(line)
+        except ValueError:
+            continue
+        if "preset" in entry:
+            swatches[entry["preset"]] = entry["swatch"]
+        else:
+            summary = entry
+    return swatches, summary
+
+def apply_preset_swatches(generation, buttons, swatches, summary, error):
+    """Puts the rendered swatches on the preset buttons, on the main thread"""
+    if generation != swatch_generation:
+        return
+    if error:
+        cmds.warning("[LayerStack] Failed to render the preset swatches: {}".format(error))
+        return
+
+    print("[LayerStack] Swatches: {} rendered, {} cached in {:.2f}s".format(summary.get("rendered"), summary.get("cached"), summary.get("total_s", 0.0)))
+    for preset_name, button in buttons.items():
+        swatch = swatches.get(preset_name)
+        if swatch and cmds.iconTextButton(button, exists=True):
+            cmds.iconTextButton(button, edit=True, style="iconAndTextHorizontal", image=swatch, height=64)
+
+def start_preset_swatches(tool, preset_dir, buttons):
+    """Renders the swatches in the background, the buttons get them when it's done"""
+    global swatch_generation
+    swatch_generation += 1
+    generation = swatch_generation
+    cache_dir = os.path.join(cmds.internalVar(userAppDir=True), "layerstack_swatches")
+
+    def run():
+        swatches, summary, error = {}, {}, None
+        try:
+            swatches, summary = render_preset_swatches(tool, preset_dir, cache_dir)
+        except Exception as e:
+            error = str(e)
+        maya.utils.executeDeferred(apply_preset_swatches, generation, buttons, swatches, summary, error)
+
+    thread = threading.Thread(target=run, name="LayerStackSwatches")
+    thread.daemon = True
+    thread.start()
 
 def create_preset_buttons():
     # Get the directory of the current script
@@ -26,15 +95,28 @@ def create_preset_buttons():
     
     # Find all JSON files in the same directory
     json_files = glob.glob(os.path.join(preset_dir, "*.json"))
+    swatch_tool = find_swatch_tool(os.path.dirname(script_path))
     
     # Create buttons for each JSON file
     if json_files:
+        buttons = {}
         for json_file in json_files:
             json_file = os.path.normpath(json_file)
             file_name = os.path.basename(json_file)
             preset_name = os.path.splitext(file_name)[0]
             #print(json_file)
 
+            # Text only until the swatch renderer is done
+            if swatch_tool:
+                buttons[preset_name] = cmds.iconTextButton(
+                    style="textOnly",
+                    label=preset_name,
+                    command=lambda *args, path=json_file: load_layer_structure(path),
+                    parent=preset_parent_layout,
+                    height=30
+                )
+                continue
+
             # Create button with a different color to distinguish from other buttons
             cmds.button(
                 label=preset_name,
@@ -42,6 +124,9 @@ def create_preset_buttons():
                 parent=preset_parent_layout,
                 height=30
             )
+
+        if buttons:
+            start_preset_swatches(swatch_tool, preset_dir, buttons)
     else:
         cmds.text(label="No presets found", align="center")
 
@@ -71,13 +156,17 @@ def create_ui():
     
     # Create left panel for mesh selection
     left_panel = cmds.columnLayout("leftPanel", adjustableColumn=True, columnAttach=('both', 5), rowSpacing=10, width=200)
-    cmds.text(label="Selected Mesh:", align="left", font="boldLabelFont")
+    cmds.text(label="Selected Meshes:", align="left", font="boldLabelFont")
     mesh_field = cmds.textField("selectedMeshField", editable=False)
     cmds.button(label="Select Mesh", command=select_mesh)
     cmds.separator(height=20, style='in')
     cmds.button(label="Apply Material", command=apply_function, height=50, backgroundColor=[0.2, 0.7, 0.2])
+    cmds.checkBox("flattenLayersCheckBox", label="Flatten Layers", value=False,
+                  annotation="Create a single surface node holding the layers, instead of a network of layer nodes")
     cmds.button(label="Save Layer Structure", command=save_layer_structure)
     cmds.button(label="Load Layer Structure", command=load_from_file)
+    cmds.button(label="Import Preset Library", command=import_preset_library,
+                annotation="Create the materials of every preset in a directory at once")
 
     # Preset section
     preset_separator = cmds.separator(height=20, style='in', horizontal=True)
@@ -616,18 +705,18 @@ def remove_layer(layer_id, *args):
     refresh_layer_tree_ui()
 
 def select_mesh(*args):
-    # Get the current selection
-    selection = cmds.ls(selection=True, type="transform")
+    # Get the current selection, long names so instances stay distinct
+    selection = cmds.ls(selection=True, type="transform", long=True)
     
     # Check if something is selected
     if selection:
-        # Check if the selected object has a mesh shape
-        shapes = cmds.listRelatives(selection[0], shapes=True)
-        if shapes and cmds.objectType(shapes[0]) == "mesh":
-            # Update the text field with the selected mesh name
-            cmds.textField("selectedMeshField", edit=True, text=selection[0])
+        # Keep the selected objects that have a mesh shape
+        meshes = [obj for obj in selection if cmds.listRelatives(obj, shapes=True, type="mesh")]
+        if meshes:
+            # Update the text field with the selected mesh names, the command takes them space separated
+            cmds.textField("selectedMeshField", edit=True, text=" ".join(meshes))
         else:
-            cmds.warning("Selected object is not a mesh.")
+            cmds.warning("Selected objects are not meshes.")
     else:
         cmds.warning("Nothing selected. Please select a mesh.")
 
@@ -656,7 +745,8 @@ def apply_function(*args):
             first_material = layer_tree["root"]["children"][0]
             first_material_name = layer_tree[first_material]["params"]["name"]
             first_material_name = cleanup_material_name(first_material_name)
-            cmds.applyMultiLayerMaterial(selected_mesh, json_tree, first_material_name)
+            flags = ["-flatten"] if cmds.checkBox("flattenLayersCheckBox", query=True, value=True) else []
+            cmds.applyMultiLayerMaterial(selected_mesh, json_tree, first_material_name, *flags)
         else:
             cmds.warning("No mesh selected. Please select a mesh first.")
     except Exception as e:
@@ -711,6 +801,20 @@ def load_from_file(*args):
 
     load_layer_structure(file_path[0])
 
+def import_preset_library(*args):
+    global preset_dir
+    dir_path = cmds.fileDialog2(dialogStyle=2, fileMode=3, caption="Import Preset Library", startingDirectory=preset_dir)
+
+    if not dir_path:
+        return
+
+    try:
+        flags = ["-flatten"] if cmds.checkBox("flattenLayersCheckBox", query=True, value=True) else []
+        shading_groups = cmds.importMultiLayerMaterialLibrary(dir_path[0], *flags) or []
+        cmds.confirmDialog(title="Success", message="Imported {} material(s)".format(len(shading_groups)), button=["OK"])
+    except Exception as e:
+        cmds.confirmDialog(title="LayerStack Error", message="{}".format(str(e)), button=["OK"])
+
 def load_layer_structure(file_path):
 
     if file_path: